@@ -11,11 +11,24 @@
 #include <fstream>
 #include <iterator>
 #include <string>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <cstdio>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
 #include "statistic.h"
+#include "perf.h"
+#include "trace.h"
+#include "tournament.h"
+#include "remote.h"
+#include "book.h"
+#include "columns.h"
+#include "service.h"
 
 int main(int argc, const char* argv[]) {
 	std::cout << "2584-Demo: ";
@@ -25,7 +38,20 @@ int main(int argc, const char* argv[]) {
 	size_t total = 1000, block = 0, limit = 0;
 	std::string play_args, evil_args;
 	std::string load, save;
+	std::string stop;
+	std::string trace_path;
+	size_t trace_period = 16;
+	std::string tournament_nets;
+	std::string serve;
+	std::string eval_serve;
+	size_t eval_batch = 4096;
+	bool eval_keep = false;
+	std::string book_path, book_play = "name=expectimax depth=3";
+	std::string export_path, export_moves;
+	size_t book_size = 4096, book_moves = 32;
+	size_t threads = 0;
 	bool summary = false;
+	bool counters = false;
 	for (int i = 1; i < argc; i++) {
 		std::string para(argv[i]);
 		if (para.find("--total=") == 0) {
@@ -42,12 +68,151 @@ int main(int argc, const char* argv[]) {
 			load = para.substr(para.find("=") + 1);
 		} else if (para.find("--save=") == 0) {
 			save = para.substr(para.find("=") + 1);
+		} else if (para.find("--stop=") == 0) {
+			stop = para.substr(para.find("=") + 1);
 		} else if (para.find("--summary") == 0) {
 			summary = true;
+		} else if (para.find("--perf") == 0) {
+			counters = true;
+		} else if (para.find("--trace=") == 0) {
+			trace_path = para.substr(para.find("=") + 1);
+		} else if (para.find("--tournament=") == 0) {
+			tournament_nets = para.substr(para.find("=") + 1);
+		} else if (para.find("--serve=") == 0) {
+			serve = para.substr(para.find("=") + 1);
+		} else if (para.find("--eval-serve=") == 0) {
+			eval_serve = para.substr(para.find("=") + 1);
+		} else if (para.find("--eval-batch=") == 0) {
+			eval_batch = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--eval-keep") == 0) {
+			eval_keep = true;
+		} else if (para.find("--threads=") == 0) {
+			threads = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--book=") == 0) {
+			book_path = para.substr(para.find("=") + 1);
+		} else if (para.find("--book-play=") == 0) {
+			book_play = para.substr(para.find("=") + 1);
+		} else if (para.find("--book-size=") == 0) {
+			book_size = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--book-moves=") == 0) {
+			book_moves = std::stoull(para.substr(para.find("=") + 1));
+		} else if (para.find("--export=") == 0) {
+			export_path = para.substr(para.find("=") + 1);
+		} else if (para.find("--export-moves=") == 0) {
+			export_moves = para.substr(para.find("=") + 1);
+		} else if (para.find("--trace-period=") == 0) {
+			trace_period = std::max(std::stoull(para.substr(para.find("=") + 1)), 1ull);
 		}
 	}
 
-	statistic stat(total, block, limit);
+	if (tournament_nets.size()) {
+		tournament league(tournament_nets, play_args, evil_args, total, threads);
+		league.run();
+		league.summary();
+		return 0;
+	}
+
+	if (serve.size()) {
+		player owner(play_args);
+		parameter_server(serve, owner.weights()).run();
+		return 0;
+	}
+
+	// answer the value and move requests of external tools by --threads workers, see service.h
+	if (eval_serve.size()) {
+		player owner(play_args + " alpha=0");
+		evaluation_server(eval_serve, owner, threads, eval_batch, eval_keep).run();
+		return 0;
+	}
+
+	// with multiple threads, each thread trains its own share of episodes on the shared network,
+	// and the records of the other threads are merged into this statistic at the end (for --summary)
+	threads = std::max<size_t>(threads, 1);
+	if (stop.size() && threads > 1) {
+		std::cerr << "--stop does not support --threads, the rule decides on the episodes of one statistic" << std::endl;
+		return 1;
+	}
+	statistic stat(total - (total / threads) * (threads - 1), block, limit ? limit : total, stop);
+
+	// a player with server=PATH is a worker of distributed training, see remote.h
+	std::unique_ptr<player> self;
+	if ((" " + play_args).find(" server=") != std::string::npos) {
+		if (threads > 1) {
+			std::cerr << "--threads does not support server=, run a worker process per thread instead" << std::endl;
+			return 1;
+		}
+		self.reset(new worker(play_args));
+	} else {
+		self.reset(new player(play_args));
+	}
+	player& play = *self;
+	auto environment = [&](player& play) -> agent* {
+		if ((" " + evil_args + " ").find(" name=evil ") != std::string::npos)
+			return new evilenv(play, evil_args);
+		return new rndenv(evil_args);
+	};
+	std::unique_ptr<agent> env(environment(play));
+	agent& evil = *env;
+
+	// statistic keeps only the summaries of episodes, so the full episodes are streamed to --save
+	// (through a temporary file, since it may be the same as --load) and to the opening book as they close
+	// the sinks take the episodes of all threads, one at a time, along with the seed of the environment that played it
+	// (the sources are the environments of the threads, none while --load replays the episodes of another run)
+	std::vector<std::function<void(const episode&)>> sinks;
+	std::mutex sinking;
+	std::vector<agent*> sources(std::max<size_t>(threads, 1), nullptr);
+	int64_t seed = -1;
+	auto observe = [&](statistic& stat, size_t t) {
+		stat.observe([&, t](const episode& ep) {
+			std::lock_guard<std::mutex> guard(sinking);
+			rndenv* rnd = dynamic_cast<rndenv*>(sources[t]);
+			seed = rnd ? int64_t(rnd->seed()) : -1;
+			for (auto& sink : sinks) sink(ep);
+		});
+	};
+	std::ofstream log;
+	if (save.size()) {
+		log.open(save + ".tmp", std::ios::out | std::ios::trunc);
+		sinks.push_back([&](const episode& ep) {
+			TRACE_SCOPE("statistic_save");
+			log << ep << '\n';
+		});
+	}
+	book_builder builder(book_moves);
+	if (book_path.size()) {
+		sinks.push_back([&](const episode& ep) { builder.collect(ep.actions()); });
+	}
+
+	// --export writes one row per episode, and --export-moves one row per move, as Arrow IPC or typed CSV (see columns.h)
+	std::unique_ptr<columns> episodes, moves;
+	uint64_t index = 0;
+	if (export_path.size()) {
+		episodes.reset(new columns(export_path, { columns::uint64("episode"), columns::int64("score"), columns::uint8("tile"),
+			columns::int64("max_tile"), columns::uint32("slides"), columns::uint32("places"), columns::uint32("time_ms"),
+			columns::uint32("slide_time_ms"), columns::uint32("place_time_ms"), columns::int64("seed"), columns::uint32("version") }));
+	}
+	if (export_moves.size()) {
+		moves.reset(new columns(export_moves, { columns::uint64("episode"), columns::uint32("step"), columns::uint8("slide"),
+			columns::int8("op"), columns::int8("position"), columns::int8("tile"), columns::int64("reward"), columns::uint32("time_ms") }));
+	}
+	if (episodes || moves) {
+		sinks.push_back([&](const episode& ep) {
+			if (episodes) {
+				record rec(ep);
+				episodes->row({ int64_t(index), rec.score, rec.tile, int64_t(board::fibb(rec.tile + 1)), rec.slides, rec.places,
+					rec.time, rec.slide_time, rec.place_time, seed, play.network_version() });
+			}
+			uint32_t step = 0;
+			if (moves) ep.each_move([&](action move, board::reward reward, time_t time) {
+				bool slide = move.type() == action::slide::type;
+				action::place at(move);
+				moves->row({ int64_t(index), step++, slide, slide ? int(move.event() & 3) : -1,
+					slide ? -1 : int(at.position()), slide ? -1 : int(at.tile()), reward, time });
+			});
+			index++;
+		});
+	}
+	if (sinks.size()) observe(stat, 0);
 
 	if (load.size()) {
 		std::ifstream in(load, std::ios::in);
@@ -56,37 +221,102 @@ int main(int argc, const char* argv[]) {
 		summary |= stat.is_finished();
 	}
 
-	player play(play_args);
-	rndenv evil(evil_args);
+	if (counters && !perf::counters().open()) {
+		std::cerr << "performance counters are not available" << std::endl;
+	}
 
-	std::cout << std::endl << std::endl;
-	while (!stat.is_finished()) {
-		play.open_episode("~:" + evil.name());
-		evil.open_episode(play.name() + ":~");
-
-		stat.open_episode(play.name() + ":" + evil.name());
-		episode& game = stat.back();
-		while (true) {
-			agent& who = game.take_turns(play, evil);
-			action move = who.take_action(game.state());
-			if (game.apply_action(move) != true) break;
-			if (who.check_for_win(game.state())) break;
+	auto run = [&](statistic& stat, player& play, agent& evil) {
+		for (size_t n = 0; !stat.is_finished(); n++) {
+			trace::sample(n % trace_period == 0);
+			play.open_episode("~:" + evil.name());
+			evil.open_episode(play.name() + ":~");
+
+			{
+				perf::scope phase(perf::statistics);
+				stat.open_episode(play.name() + ":" + evil.name());
+			}
+			episode& game = stat.back();
+			TRACE_SCOPE("episode");
+			while (true) {
+				agent& who = game.take_turns(play, evil);
+				perf::scope phase(&who == &play ? perf::player : perf::environment);
+				action move;
+				{
+					TRACE_SCOPE("take_action");
+					move = who.take_action(game.state());
+				}
+				TRACE_SCOPE("apply_action");
+				if (game.apply_action(move) != true) break;
+				if (who.check_for_win(game.state())) break;
+			}
+			agent& win = game.last_turns(play, evil);
+			{
+				perf::scope phase(perf::statistics);
+				stat.close_episode(win.name());
+			}
+
+			{
+				perf::scope phase(perf::update);
+				play.close_episode(win.name());
+			}
+			evil.close_episode(win.name());
 		}
-		agent& win = game.last_turns(play, evil);
-		stat.close_episode(win.name());
+		trace::sample(true);
+	};
 
-		play.close_episode(win.name());
-		evil.close_episode(win.name());
+	std::cout << std::endl << std::endl;
+	std::vector<std::unique_ptr<player>> mates;
+	std::vector<std::unique_ptr<statistic>> parts;
+	for (size_t t = 1; t < threads; t++) {
+		mates.emplace_back(play.mate());
+		mates.back()->reseed(board::mix(t));
+		parts.emplace_back(new statistic(total / threads)); // shows the result of this thread at the end
+		if (sinks.size()) observe(*parts.back(), t);
+	}
+	std::vector<std::thread> workers;
+	for (size_t t = 1; t < threads; t++) {
+		workers.emplace_back([&, t]() {
+			player& mate = *mates[t - 1];
+			std::unique_ptr<agent> env(environment(mate));
+			if (random_agent* rnd = dynamic_cast<random_agent*>(env.get())) rnd->reseed(board::mix(t));
+			sources[t] = env.get();
+			run(*parts[t - 1], mate, *env);
+		});
 	}
+	sources[0] = &evil;
+	run(stat, play, evil);
+	for (std::thread& worker : workers) worker.join();
+	for (auto& part : parts) stat.merge(*part);
+	mates.clear();
 
 	if (summary) {
 		stat.summary();
 	}
 
+	// build an opening book from the episodes of this run (or of --load), solved by --book-play players
+	if (book_path.size()) {
+		player solver("alpha=0 " + book_play);
+		if (!solver.weights()) {
+			std::cerr << "the book needs a network, use --book-play=\"... load=PATH\"" << std::endl;
+			return 1;
+		}
+		book opening(book_size, book_moves);
+		double coverage = builder.solve(opening, book_size, threads, [&]() { return std::unique_ptr<agent>(new player(solver)); });
+		if (!opening.save(book_path)) std::exit(-1);
+		std::cout << "book: " << opening.size() << " of " << builder.distinct() << " positions in the first " << book_moves << " moves, ";
+		std::cout << "covering " << (coverage * 100) << "% of visits" << std::endl;
+	}
+
 	if (save.size()) {
-		std::ofstream out(save, std::ios::out | std::ios::trunc);
-		out << stat;
-		out.close();
+		log.close();
+		std::rename((save + ".tmp").c_str(), save.c_str());
+	}
+
+	if (trace_path.size()) {
+		if (trace::enabled)
+			trace::dump_at_exit(trace_path);
+		else
+			std::cerr << "tracing is not compiled in, rebuild with -DTRACE (make trace)" << std::endl;
 	}
 
 	return 0;
@@ -93,7 +93,7 @@ protected:
 class action::place : public action {
 public:
 	static constexpr unsigned type = type_flag('p');
-	place(unsigned pos, unsigned tile) : action(place::type | (pos & 0x0f) | (std::min(tile, 35u) << 4)) {}
+	place(unsigned pos, unsigned tile) : action(place::type | (pos & 0x0f) | (std::min(tile, 61u) << 4)) {}
 	place(const action& a = {}) : action(a) {}
 	unsigned position() const { return event() & 0x0f; }
 	unsigned tile() const { return event() >> 4; }
@@ -102,17 +102,17 @@ public:
 		return b.place(position(), tile());
 	}
 	std::ostream& operator >>(std::ostream& out) const {
-		const char* idx = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ?";
-		return out << idx[position()] << idx[std::min(tile(), 36u)];
+		const char* idx = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz?";
+		return out << idx[position()] << idx[std::min(tile(), 62u)];
 	}
 	std::istream& operator <<(std::istream& in) {
-		const char* idx = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+		const char* idx = "0123456789ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz";
 		char v = in.peek();
 		unsigned pos = std::find(idx, idx + 16, v) - idx;
 		if (pos < 16) {
 			in.ignore(1) >> v;
-			unsigned tile = std::find(idx, idx + 36, v) - idx;
-			if (tile < 36) {
+			unsigned tile = std::find(idx, idx + 62, v) - idx;
+			if (tile < 62) {
 				operator =(action::place(pos, tile));
 				return in;
 			}
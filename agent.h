@@ -11,33 +11,45 @@
 #include <string>
 #include <random>
 #include <sstream>
+#include <iomanip>
 #include <map>
 #include <type_traits>
 #include <algorithm>
 #include "board.h"
 #include "action.h"
 #include "weight.h"
+#include "trace.h"
+#include "shm.h"
+#include "heatmap.h"
+#include "book.h"
 #include <fstream>
 #include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <limits>
+#include <cstdlib>
+#include <cmath>
 
 class agent
 {
 public:
+	/**
+	 * the arguments are space-separated pairs of key=value, where a later pair overrides an earlier one,
+	 * and all pairs are printed unless the arguments contain 'quiet'
+	 */
 	agent(const std::string &args = "")
 	{
-		std::stringstream ss("name=unknown role=unknown " + args);
-		for (std::string pair; ss >> pair;)
-		{
-			std::string key = pair.substr(0, pair.find('='));
-			std::string value = pair.substr(pair.find('=') + 1);
-			meta[key] = {value};
-		}
+		parse("name=unknown role=unknown " + args);
+		if (meta.find("quiet") != meta.end())
+			return;
+		std::string line;
 		for (std::map<key, value>::const_iterator it = meta.begin();
 			 it != meta.end(); ++it)
 		{
-			std::cout << it->first << "=" << it->second.value << ";";
+			line += it->first + "=" + it->second.value + ";";
 		}
-		std::cout << std::endl;
+		std::cout << line << std::endl;
 	}
 	virtual ~agent() {}
 	virtual void open_episode(const std::string &flag = "") {}
@@ -47,20 +59,47 @@ public:
 
 public:
 	virtual std::string property(const std::string &key) const { return meta.at(key); }
-	virtual void notify(const std::string &msg) { meta[msg.substr(0, msg.find('='))] = {msg.substr(msg.find('=') + 1)}; }
+	virtual void notify(const std::string &msg) { parse(msg); }
 	virtual std::string name() const { return property("name"); }
 	virtual std::string role() const { return property("role"); }
 
 protected:
 	typedef std::string key;
+	/**
+	 * an option, whose number is parsed once when it is set (NaN if the value is not a number),
+	 * so that converting it to an arithmetic type costs no parsing
+	 */
 	struct value
 	{
 		std::string value;
+		double number;
 		operator std::string() const { return value; }
 		template <typename numeric, typename = typename std::enable_if<std::is_arithmetic<numeric>::value, numeric>::type>
-		operator numeric() const { return numeric(std::stod(value)); }
+		operator numeric() const
+		{
+			if (std::isnan(number))
+				throw std::invalid_argument(value + " is not a number");
+			return numeric(number);
+		}
 	};
 	std::map<key, value> meta;
+
+private:
+	void parse(const std::string &args)
+	{
+		for (size_t i = args.find_first_not_of(' '); i != std::string::npos; i = args.find_first_not_of(' ', i))
+		{
+			size_t end = std::min(args.find(' ', i), args.size());
+			size_t eq = std::min(args.find('=', i), end);
+			std::string text = args.substr(eq < end ? eq + 1 : i, end - (eq < end ? eq + 1 : i));
+			char *stop = nullptr;
+			double number = std::strtod(text.c_str(), &stop);
+			if (text.empty() || *stop)
+				number = std::numeric_limits<double>::quiet_NaN();
+			meta[args.substr(i, eq - i)] = {text, number};
+			i = end;
+		}
+	}
 };
 
 /**
@@ -76,55 +115,292 @@ public:
 	}
 	virtual ~random_agent() {}
 
+	void reseed(unsigned seed) { engine.seed(seed); }
+
+	/**
+	 * the state of the engine, which reseed() restores exactly
+	 * since the engine is a linear congruential one, whose state is its last output
+	 */
+	unsigned state() const
+	{
+		static_assert(std::is_same<std::default_random_engine, std::minstd_rand0>::value ||
+						  std::is_same<std::default_random_engine, std::minstd_rand>::value,
+					  "the state of the engine must be a single number");
+		std::stringstream ss;
+		ss << engine;
+		unsigned s = 0;
+		ss >> s;
+		return s;
+	}
+
 protected:
 	std::default_random_engine engine;
 };
 
+/**
+ * model of the random environment, shared by rndenv and search players
+ * a new tile is placed uniformly on an empty cell
+ * 1-tile: 90%
+ * 2-tile: 10%
+ */
+class env_model
+{
+public:
+	struct popup
+	{
+		board::cell tile;
+		float prob;
+	};
+	static const std::array<popup, 2> &popups()
+	{
+		static const std::array<popup, 2> table = {{{1, 0.9f}, {2, 0.1f}}};
+		return table;
+	}
+
+	/**
+	 * enumerate all placements on the given afterstate
+	 * fn(const board &next, float prob) is called once per outcome, without any allocation
+	 */
+	template <typename visitor>
+	static void for_each_outcome(const board &after, visitor &&fn)
+	{
+		unsigned empty = after.empty_mask();
+		if (!empty)
+			return;
+		float uniform = 1.0f / __builtin_popcount(empty);
+		for (; empty; empty &= empty - 1)
+		{
+			unsigned pos = __builtin_ctz(empty);
+			board next = after;
+			for (const popup &p : popups())
+			{
+				next(pos) = p.tile;
+				fn(next, uniform * p.prob);
+			}
+		}
+	}
+
+	/**
+	 * the position of the n-th (0-based) empty cell
+	 */
+	static unsigned nth_empty(unsigned empty, unsigned n)
+	{
+		while (n--)
+			empty &= empty - 1;
+		return __builtin_ctz(empty);
+	}
+};
+
 /**
  * base agent for agents with weight tables and a learning rate
  */
 class player : public random_agent
 {
+protected:
+	// the player of name=..., resolved once so that no move looks up the name
+	enum class style
+	{
+		dummy,
+		greedy_score,
+		greedy_pos,
+		TD,
+		expectimax
+	};
 
 public:
-	player(const std::string &args = "") : random_agent("name=TD alpha=0.005 role=player " + args), alpha(0), opcode({0, 1, 2, 3})
+	player(const std::string &args = "") : random_agent("name=TD alpha=0.005 role=player " + args), kind(style_of(property("name"))), alpha(0), opcode({0, 1, 2, 3}),
+										   depth(1), version(std::make_shared<std::atomic<uint32_t>>(1)), lookups(0), hits(0), deferred(false), flush(1), episodes(0),
+										   generation(0), interval(1000), published(0), publisher(false), calibrate(0), played(false), recording(false),
+										   book_lookups(0), book_hits(0), book_moves(0)
 	{
+		for (int a = 0; a < indexCount; a++)
+			std::copy(canonical_radix(), canonical_radix() + tupleSize, radix[a]);
 		if (meta.find("init") != meta.end())
 			init_weights(meta["init"]);
 		if (meta.find("load") != meta.end())
 			load_weights(meta["load"]);
+		if (meta.find("patch") != meta.end())
+			patch_weights(meta["patch"]);
+		if (meta.find("order") != meta.end() && property("order") != "auto")
+			set_order(meta["order"]);
+		else if (meta.find("order") != meta.end())
+		{
+			if (canonical_only())
+				throw std::invalid_argument("order=auto does not support export, patch, shm, publish, or server");
+			calibrate = meta.find("calibrate") != meta.end() ? std::max(int(meta["calibrate"]), 1) : 100;
+			changes.resize(indexCount);
+		}
+		if (meta.find("layout") != meta.end() && net)
+			set_layout(meta["layout"]);
 		if (meta.find("alpha") != meta.end())
 			alpha = float(meta["alpha"]);
+		if (meta.find("depth") != meta.end())
+			depth = std::max(int(meta["depth"]), 1);
+		else if (kind == style::expectimax)
+			depth = 2;
+		if (meta.find("cache") != meta.end())
+			cache.resize(size_t(1) << std::min(std::max(int(meta["cache"]), 0), 30));
+		if (meta.find("update") != meta.end() && net)
+		{
+			std::string mode = meta["update"];
+			deferred = (mode == "delta");
+			for (weight &w : *net)
+				w.mode(deferred ? weight::atomic : weight::parse(mode));
+		}
+		if (meta.find("flush") != meta.end())
+			flush = std::max(int(meta["flush"]), 1);
+		if (meta.find("shm") != meta.end())
+		{
+			store = shared_weights::attach(meta["shm"]);
+			generation = store->generation();
+			net = store->view();
+			alpha = 0;
+		}
+		else if (meta.find("publish") != meta.end() && net)
+		{
+			if (meta.find("interval") != meta.end())
+				interval = std::max(int(meta["interval"]), 1);
+			store = shared_weights::create(meta["publish"], *net);
+			store->publish(*net);
+			publisher = true;
+		}
+		if (meta.find("book") != meta.end())
+		{
+			opening = std::make_shared<book>();
+			if (!opening->load(meta["book"]))
+				throw std::invalid_argument("cannot load the book " + property("book"));
+		}
+		if (meta.find("heat") != meta.end() && net)
+		{
+			std::vector<size_t> lengths;
+			for (const weight &w : *net)
+				lengths.push_back(w.size());
+			heat = std::make_shared<heatmap>(lengths, meta.find("sample") != meta.end() ? int(meta["sample"]) : 16);
+		}
 	}
 	virtual ~player()
 	{
-		if (meta.find("save") != meta.end())
+		merge_deltas();
+		if (store && meta.find("publish") != meta.end() && net.use_count() <= 1)
+			store->publish(*net);
+		if (meta.find("save") != meta.end() && net.use_count() <= 1)
 			save_weights(meta["save"]);
+		if (meta.find("export") != meta.end() && net.use_count() <= 1)
+			export_weights(meta["export"]);
+		if (meta.find("sparsity") != meta.end() && net.use_count() <= 1)
+			sparsity_report(std::cout);
+		if (lookups)
+			std::cout << "cache: lookups = " << lookups << ", hits = " << hits
+					  << " (" << (hits * 100.0 / lookups) << "%)" << std::endl;
+		if (book_lookups)
+			std::cout << "book: lookups = " << book_lookups << ", hits = " << book_hits
+					  << " (" << (book_hits * 100.0 / book_lookups) << "%)" << std::endl;
+		if (meta.find("order") != meta.end() && net.use_count() <= 1)
+			std::cout << "order: " << order() << std::endl;
+		if (heat && heat.use_count() <= 1)
+		{
+			heat->report(std::cout);
+			if (!heat->save(meta["heat"]))
+				std::exit(-1);
+		}
 	}
 
 	virtual void open_episode(const std::string &flag = "")
 	{
 		history.clear();
+		recording = heat && heat->sample();
+		book_moves = 0;
+		played = false;
+		if (store && meta.find("shm") != meta.end() && store->generation() != generation)
+		{
+			generation = store->generation();
+			net = store->view();
+			invalidate();
+		}
 	}
 
 	virtual void close_episode(const std::string &flag = "")
 	{
+		if (calibrate && played)
+			calibrate_order();
 		if (history.empty())
 			return;
 		if (alpha == 0)
 			return;
+		TRACE_SCOPE("td_update");
 		adjust_value(history[history.size() - 1].after, 0);
 		for (int i = history.size() - 2; i >= 0; i--)
 		{
 			adjust_value(history[i].after, history[i + 1].reward + estimate_value(history[i + 1].after));
 		}
+		if (deferred && ++episodes % flush == 0)
+			merge_deltas();
+		if (publisher && ++published >= interval && store->publish(*net, 0))
+			published = 0; // retried every episode while readers still hold the slot
 	}
 
+	/**
+	 * the value of an afterstate, or 0 if the player has no network
+	 */
+	float evaluate(const board &after)
+	{
+		return (!net || net->empty()) ? 0 : estimate_value(after);
+	}
+
+	/**
+	 * the values of n afterstates, as evaluate but looked up table by table,
+	 * so that the lookups of a batch hit one table at a time
+	 */
+	void evaluate(const board *afters, float *values, size_t n)
+	{
+		std::fill(values, values + n, 0.0f);
+		if (!net || net->empty())
+			return;
+		const network &tables = *net;
+		for (int x = 0; x < indexCount; x++)
+			for (size_t i = 0; i < n; i++)
+				values[i] += tables[x][extract_feature(afters[i], x)];
+	}
+
+	/**
+	 * copies of a player share the same network, e.g., for evaluating or training in parallel
+	 * the network is saved by the last player sharing it
+	 */
+	typedef std::vector<weight> network;
+	std::shared_ptr<network> weights() const { return net; }
+
+	/**
+	 * a copy of this player for another thread, which shares the network (and the book and the heat map)
+	 * but leaves publishing it (publish=NAME) to this player, since concurrent publishers would mix the slots
+	 */
+	std::unique_ptr<player> mate() const
+	{
+		std::unique_ptr<player> copy(new player(*this));
+		copy->publisher = false;
+		return copy;
+	}
+
+	/**
+	 * the version of the network, shared by the players sharing it and bumped by all of their updates,
+	 * new shm generations, and pulls from the parameter server
+	 */
+	uint32_t network_version() const { return version->load(std::memory_order_relaxed); }
+
 protected:
+	// consistency of updates when threads share the network, see weight::consistency
+	// update=delta buffers the adjustments of this player, and merges them atomically every 'flush' episodes
+	struct delta
+	{
+		uint32_t table;
+		uint32_t index;
+		float value;
+	};
+	std::vector<delta> deltas;
+
 	// TD / n-tuple
 	struct step
 	{
-		int reward;
+		board::reward reward;
 		board after;
 	};
 	std::vector<step> history;
@@ -133,6 +409,9 @@ protected:
 	static const int maxIndex = 25;
 	int indexes[indexCount][tupleSize] = {{0, 1, 2, 3}, {4, 5, 6, 7}, {8, 9, 10, 11}, {12, 13, 14, 15}, {0, 4, 8, 12}, {1, 5, 9, 13}, {2, 6, 10, 14}, {3, 7, 11, 15}, {0, 1, 4, 5}, {1, 2, 5, 6}, {2, 3, 6, 7}, {4, 5, 8, 9}, {4, 5, 9, 10}, {4, 5, 10, 11}, {8, 9, 12, 13}, {9, 10, 13, 14}, {10, 11, 14, 15}};
 
+	// the place value of each cell of each tuple in the table index, see set_order
+	int radix[indexCount][tupleSize];
+
 	static float pow(int n, int p)
 	{
 		float base = 1;
@@ -149,7 +428,7 @@ protected:
 			int tmp = after(indexes[a][i]);
 			if (tmp >= maxIndex)
 				tmp = maxIndex - 1;
-			result += tmp * pow(maxIndex, tupleSize - i - 1);
+			result += tmp * radix[a][i];
 		}
 		return result;
 	}
@@ -162,7 +441,7 @@ protected:
 			int tmp = after(indexes[a][i]);
 			if (tmp >= maxIndex)
 				tmp = maxIndex - 1;
-			result += tmp * pow(maxIndex, tupleSize - i - 1);
+			result += tmp * radix[a][i];
 		}
 		return result;
 	}
@@ -175,17 +454,48 @@ protected:
 			int tmp = after(indexes[a][i]);
 			if (tmp >= maxIndex)
 				tmp = maxIndex - 1;
-			result += tmp * pow(maxIndex, tupleSize - i - 1);
+			result += tmp * radix[a][i];
 		}
 		return result;
 	}
 
 	float estimate_value(const board &after)
 	{
+		memo *entry = nullptr;
+		uint64_t key = 0;
+		uint32_t stamp = 0;
+		if (!cache.empty())
+		{
+			key = after.hash();
+			entry = &cache[key & (cache.size() - 1)];
+			stamp = network_version(); // read before the tables, so that a concurrent update leaves the entry stale
+			lookups++;
+			if (entry->key == key && entry->version == stamp)
+			{
+				hits++;
+				return entry->value;
+			}
+		}
+
+		const network &tables = *net;
 		float value = 0;
-		for (int x = 0; x < indexCount; x++)
-			value += net[x][extract_feature(after, x)];
+		if (recording)
+		{
+			for (int x = 0; x < indexCount; x++)
+			{
+				int index = extract_feature(after, x);
+				heat->read(x, index);
+				value += tables[x][index];
+			}
+		}
+		else
+		{
+			for (int x = 0; x < indexCount; x++)
+				value += tables[x][extract_feature(after, x)];
+		}
 
+		if (entry)
+			*entry = {key, stamp, value};
 		return value;
 	}
 
@@ -194,20 +504,74 @@ protected:
 		float current = estimate_value(after);
 		float error = target - current;
 		float adjust = alpha * error;
-		for (int x = 0; x < indexCount; x++)
-			net[x][extract_feature(after, x)] += adjust;
+		if (recording)
+			for (int x = 0; x < indexCount; x++)
+				heat->write(x, extract_feature(after, x));
+		if (deferred)
+		{
+			for (int x = 0; x < indexCount; x++)
+				deltas.push_back({uint32_t(x), uint32_t(extract_feature(after, x)), adjust});
+		}
+		else
+		{
+			for (int x = 0; x < indexCount; x++)
+				(*net)[x].update(extract_feature(after, x), adjust);
+		}
+		invalidate();
+	}
+
+	/**
+	 * bump the version of the network, which drops the cached values of all players sharing it
+	 */
+	void invalidate()
+	{
+		version->fetch_add(1, std::memory_order_relaxed);
+	}
+
+	/**
+	 * apply the buffered adjustments to the shared network (update=delta)
+	 */
+	virtual void merge_deltas()
+	{
+		coalesce_deltas();
+		for (const delta &d : deltas)
+			(*net)[d.table].update(d.index, d.value);
+		if (deltas.size())
+			invalidate();
+		deltas.clear();
+	}
+
+	/**
+	 * sum the buffered adjustments to the same entry, to reduce contention and traffic
+	 */
+	void coalesce_deltas()
+	{
+		std::sort(deltas.begin(), deltas.end(), [](const delta &a, const delta &b)
+				  { return a.table != b.table ? a.table < b.table : a.index < b.index; });
+		size_t n = 0;
+		for (size_t i = 0; i < deltas.size(); i++)
+		{
+			if (n && deltas[n - 1].table == deltas[i].table && deltas[n - 1].index == deltas[i].index)
+				deltas[n - 1].value += deltas[i].value;
+			else
+				deltas[n++] = deltas[i];
+		}
+		deltas.resize(n);
 	}
 
 	action td_nTuple_action(const board &before)
 	{
 		int best_op = -1;
-		int best_reward = -1;
+		board::reward best_reward = -1;
 		float best_value = -100000;
 		board best_afterstate;
+		board afters[4];
+		board::reward rewards[4];
+		board::slide_each(before, afters, rewards);
 		for (int op : opcode)
 		{
-			board after = before;
-			int reward = after.slide(op);
+			const board &after = afters[op];
+			board::reward reward = rewards[op];
 			if (reward == -1)
 				continue;
 			float value = estimate_value(after);
@@ -226,6 +590,69 @@ protected:
 		return action::slide(best_op);
 	}
 
+	// expectimax search over afterstates, with the n-tuple network at the leaves
+	float search_max(const board &before, int depth)
+	{
+		float best = 0;
+		bool moved = false;
+		board afters[4];
+		board::reward rewards[4];
+		board::slide_each(before, afters, rewards);
+		for (int op : opcode)
+		{
+			const board &after = afters[op];
+			board::reward reward = rewards[op];
+			if (reward == -1)
+				continue;
+			float value = reward + search_chance(after, depth);
+			if (!moved || value > best)
+				best = value;
+			moved = true;
+		}
+		return best;
+	}
+
+	float search_chance(const board &after, int depth)
+	{
+		if (depth <= 1)
+			return estimate_value(after);
+		float expect = 0;
+		env_model::for_each_outcome(after, [&](const board &next, float prob)
+									{ expect += prob * search_max(next, depth - 1); });
+		return expect;
+	}
+
+	action expectimax_action(const board &before)
+	{
+		int best_op = -1;
+		board::reward best_reward = -1;
+		float best_value = 0;
+		board best_afterstate;
+		board afters[4];
+		board::reward rewards[4];
+		board::slide_each(before, afters, rewards);
+		for (int op : opcode)
+		{
+			const board &after = afters[op];
+			board::reward reward = rewards[op];
+			if (reward == -1)
+				continue;
+			float value = search_chance(after, depth);
+			if (best_op == -1 || reward + value > best_reward + best_value)
+			{
+				best_op = op;
+				best_reward = reward;
+				best_value = value;
+				best_afterstate = after;
+			}
+		}
+		if (best_op == -1)
+			return action();
+		if (alpha != 0)
+			history.push_back({best_reward, best_afterstate});
+		return action::slide(best_op);
+	}
+
 	// baseline models
 	action dummy_action(const board &before)
 	{
@@ -281,81 +708,600 @@ protected:
 		return action();
 	}
 
-	virtual action take_action(const board &before)
+	/**
+	 * the move of the opening book (book=PATH), which is recorded for TD learning as td_nTuple_action does,
+	 * or an empty action on a miss, see book.h
+	 */
+	action book_action(const board &before)
 	{
-		if (property("name") == "greedy_score")
-			return greedy_score_action(before);
-		else if (property("name") == "greedy_pos")
-			return greedy_pos_action(before);
-		else if (property("name") == "TD")
-			return td_nTuple_action(before);
-		else if (property("name") == "dummy")
-			return dummy_action(before);
+		if (book_moves++ >= opening->depth())
+			return action();
+		book_lookups++;
+		int op = opening->find(before);
+		if (op < 0)
+			return action();
+		board after = before;
+		board::reward reward = after.slide(op);
+		if (reward == -1)
+			return action();
+		book_hits++;
+		if (kind == style::TD || alpha != 0)
+			history.push_back({reward, after});
+		return action::slide(op);
+	}
+
+	static style style_of(const std::string &name)
+	{
+		if (name == "greedy_score")
+			return style::greedy_score;
+		else if (name == "greedy_pos")
+			return style::greedy_pos;
+		else if (name == "TD")
+			return style::TD;
+		else if (name == "expectimax")
+			return style::expectimax;
+		else if (name == "dummy")
+			return style::dummy;
 		else
-			throw std::invalid_argument(property("name") + " is not a valid player name");
+			throw std::invalid_argument(name + " is not a valid player name");
+	}
+
+	virtual action take_action(const board &before)
+	{
+		action move;
+		if (opening && (kind == style::TD || kind == style::expectimax))
+			move = book_action(before);
+		if (move.type() != action::slide::type)
+		{
+			switch (kind)
+			{
+			case style::greedy_score:
+				move = greedy_score_action(before);
+				break;
+			case style::greedy_pos:
+				move = greedy_pos_action(before);
+				break;
+			case style::TD:
+				move = td_nTuple_action(before);
+				break;
+			case style::expectimax:
+				move = expectimax_action(before);
+				break;
+			default:
+				move = dummy_action(before);
+				break;
+			}
+		}
+		if (calibrate && move.type() == action::slide::type)
+			count_changes(before, move.event());
+		return move;
 	}
 
 	virtual void init_weights(const std::string &info)
 	{
+		net = std::make_shared<network>();
 		for (int i = 0; i < indexCount; i++)
-			net.emplace_back(pow(maxIndex, tupleSize));
+			net->emplace_back(pow(maxIndex, tupleSize));
 	}
 	virtual void load_weights(const std::string &path)
 	{
+		TRACE_SCOPE("load_weights");
 		std::ifstream in(path, std::ios::in | std::ios::binary);
 		if (!in.is_open())
 			std::exit(-1);
 		uint32_t size;
 		in.read(reinterpret_cast<char *>(&size), sizeof(size));
-		net.resize(size);
-		for (weight &w : net)
+		net = std::make_shared<network>(size);
+		for (weight &w : *net)
 			in >> w;
 		in.close();
+		for (int a = 0; a < indexCount && a < int(net->size()); a++)
+			if (!std::equal(radix[a], radix[a] + tupleSize, canonical_radix()))
+				(*net)[a] = reorder((*net)[a], canonical_radix(), radix[a]);
 	}
 	virtual void save_weights(const std::string &path)
 	{
+		TRACE_SCOPE("save_weights");
 		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
 		if (!out.is_open())
 			std::exit(-1);
-		uint32_t size = net.size();
+		uint32_t size = net ? net->size() : 0;
 		out.write(reinterpret_cast<char *>(&size), sizeof(size));
-		for (weight &w : net)
-			out << w;
+		if (net)
+			for (size_t a = 0; a < net->size(); a++)
+			{
+				if (a < indexCount && !std::equal(radix[a], radix[a] + tupleSize, canonical_radix()))
+					out << reorder((*net)[a], radix[a], canonical_radix());
+				else
+					out << (*net)[a];
+			}
 		out.close();
 	}
 
+	static const int *canonical_radix()
+	{
+		static const int place[tupleSize] = {maxIndex * maxIndex * maxIndex, maxIndex * maxIndex, maxIndex, 1};
+		return place;
+	}
+
+	/**
+	 * order=SPEC: the order of the cells of each tuple in the table index, from the most significant digit,
+	 * as one permutation for all tuples or a comma-separated permutation per tuple, e.g., 3210 or 0123,3210,...
+	 * placing the cells that change most often at the least significant digits keeps
+	 * the lookups of consecutive afterstates closer in the table
+	 * order=auto: choose such an order per tuple from the changes of cells over the first 'calibrate' episodes
+	 * (100 by default), which applies only if this player is the sole owner of the network
+	 *
+	 * the weight files are always in the canonical order 0123, the tables are converted on load and save
+	 * deltas and shared networks (export, patch, shm, publish, server) are kept in the canonical order only
+	 */
+	void set_order(const std::string &spec)
+	{
+		std::vector<std::string> perms;
+		std::stringstream ss(spec);
+		for (std::string perm; std::getline(ss, perm, ',');)
+			perms.push_back(perm);
+		if (perms.size() != 1 && perms.size() != indexCount)
+			throw std::invalid_argument(spec + " is not a valid order");
+		int next[indexCount][tupleSize];
+		for (int a = 0; a < indexCount; a++)
+		{
+			const std::string &perm = perms[perms.size() == 1 ? 0 : a];
+			std::string sorted(perm);
+			std::sort(sorted.begin(), sorted.end());
+			if (sorted != "0123")
+				throw std::invalid_argument(spec + " is not a valid order");
+			for (int k = 0; k < tupleSize; k++)
+				next[a][perm[k] - '0'] = pow(maxIndex, tupleSize - k - 1);
+		}
+		bool canonical = true;
+		for (int a = 0; a < indexCount; a++)
+			canonical &= std::equal(next[a], next[a] + tupleSize, canonical_radix());
+		if (!canonical && canonical_only())
+			throw std::invalid_argument("order=" + spec + " does not support export, patch, shm, publish, or server");
+		if (net)
+			for (int a = 0; a < indexCount; a++)
+				if (!std::equal(next[a], next[a] + tupleSize, radix[a]))
+					(*net)[a] = reorder((*net)[a], radix[a], next[a]);
+		std::copy(&next[0][0], &next[0][0] + indexCount * tupleSize, &radix[0][0]);
+		invalidate();
+	}
+
+	/**
+	 * whether the network is exchanged with others (export, patch, shm, publish, server), and thus kept in the canonical order
+	 */
+	bool canonical_only() const
+	{
+		for (const char *key : {"export", "patch", "shm", "publish", "server"})
+			if (meta.find(key) != meta.end())
+				return true;
+		return false;
+	}
+
+	/**
+	 * the current order, in the format of set_order
+	 */
+	std::string order() const
+	{
+		std::string spec;
+		for (int a = 0; a < indexCount; a++)
+		{
+			std::string perm(tupleSize, '0');
+			for (int i = 0; i < tupleSize; i++)
+				for (int k = 0; k < tupleSize; k++)
+					if (radix[a][i] == canonical_radix()[k])
+						perm[k] = '0' + i;
+			spec += (a ? "," : "") + perm;
+		}
+		return spec;
+	}
+
+	/**
+	 * move the entries of a table from the place values 'from' to the place values 'to'
+	 */
+	static weight reorder(const weight &table, const int from[tupleSize], const int to[tupleSize])
+	{
+		weight next(table.size());
+		next.mode(table.mode());
+		for (size_t index = 0; index < table.size(); index++)
+		{
+			size_t target = 0;
+			for (int i = 0; i < tupleSize; i++)
+				target += (index / from[i] % maxIndex) * to[i];
+			next[target] = table[index];
+		}
+		if (table.compact())
+			next.compact(table.block());
+		return next;
+	}
+
+	/**
+	 * count the changes of each cell of each tuple between consecutive afterstates played (order=auto),
+	 * whether or not they are recorded for learning, e.g., by expectimax with alpha=0
+	 */
+	void count_changes(const board &before, unsigned op)
+	{
+		board after = before;
+		if (after.slide(op) == -1)
+			return;
+		if (played)
+			for (int a = 0; a < indexCount; a++)
+				for (int i = 0; i < tupleSize; i++)
+					changes[a][i] += (after(indexes[a][i]) != last(indexes[a][i]));
+		last = after;
+		played = true;
+	}
+
+	/**
+	 * after the first 'calibrate' episodes, sort the cells of each tuple by the counts, from the most stable one
+	 */
+	void calibrate_order()
+	{
+		if (--calibrate || net.use_count() > 1)
+			return;
+		std::string spec;
+		for (int a = 0; a < indexCount; a++)
+		{
+			std::string perm("0123");
+			std::stable_sort(perm.begin(), perm.end(), [&](char x, char y)
+							 { return changes[a][x - '0'] < changes[a][y - '0']; });
+			spec += (a ? "," : "") + perm;
+		}
+		set_order(spec);
+	}
+
+	/**
+	 * layout=compact: two-level tables indexed by the first 'prefix' cells of each tuple (2 by default),
+	 * where the blocks of the unreached prefixes are not allocated, see weight::compact
+	 * layout=flat: plain arrays (default)
+	 * the compact layout is an in-memory layout, the weight files are the same
+	 */
+	void set_layout(const std::string &layout)
+	{
+		int prefix = 2;
+		if (meta.find("prefix") != meta.end())
+			prefix = std::min(std::max(int(meta["prefix"]), 1), tupleSize - 1);
+		if (layout == "flat")
+			return;
+		if (layout != "compact")
+			throw std::invalid_argument(layout + " is not a valid layout");
+		if (meta.find("shm") != meta.end() || meta.find("publish") != meta.end() || meta.find("server") != meta.end())
+			throw std::invalid_argument("layout=compact does not support shm, publish, or server");
+		for (weight &w : *net)
+			w.compact(pow(maxIndex, tupleSize - prefix));
+	}
+
+	/**
+	 * incremental checkpoints: export=PATH writes only the pages touched since the network was loaded,
+	 * and patch=PATH[,PATH...] applies such deltas in order after load, e.g.,
+	 * load=base.bin patch=d1.bin,d2.bin export=d3.bin
+	 * the delta file is uint32 tables, then a delta of each table, see weight::write_delta
+	 */
+	virtual void export_weights(const std::string &path)
+	{
+		TRACE_SCOPE("export_weights");
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open())
+			std::exit(-1);
+		uint32_t size = net ? net->size() : 0;
+		out.write(reinterpret_cast<char *>(&size), sizeof(size));
+		if (net)
+			for (weight &w : *net)
+				w.write_delta(out);
+		out.close();
+	}
+	virtual void patch_weights(const std::string &paths)
+	{
+		TRACE_SCOPE("patch_weights");
+		std::string list(paths);
+		std::replace(list.begin(), list.end(), ',', ' ');
+		std::stringstream ss(list);
+		for (std::string path; ss >> path;)
+		{
+			std::ifstream in(path, std::ios::in | std::ios::binary);
+			if (!in.is_open() || !net)
+				std::exit(-1);
+			uint32_t size = 0;
+			in.read(reinterpret_cast<char *>(&size), sizeof(size));
+			if (size != net->size())
+				throw std::invalid_argument(path + " does not match the network");
+			for (weight &w : *net)
+				if (!w.read_delta(in))
+					throw std::invalid_argument(path + " does not match the network");
+		}
+	}
+
+	/**
+	 * show the usage of each table, to guide the choice of tuples and table sizes
+	 *
+	 * the format would be
+	 * sparsity: 17 tables, 6640625 entries, 64 entries per page
+	 *         [0]     nonzero = 83611 (21.40%), touched = 1024/6104 pages
+	 *         ...
+	 *         total   nonzero = 2212226 (33.31%), touched = 26449/103768 pages, memory = 25.33MB
+	 *
+	 * where touched pages are counted since the network was loaded, and memory is the size of the tables in the current layout
+	 */
+	void sparsity_report(std::ostream &out) const
+	{
+		if (!net)
+			return;
+		size_t entries = 0;
+		for (const weight &w : *net)
+			entries += w.size();
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "sparsity: " << net->size() << " tables, " << entries << " entries, " << weight::page << " entries per page" << std::endl;
+		size_t nonzero = 0, touched = 0, pages = 0, bytes = 0;
+		for (size_t i = 0; i < net->size(); i++)
+		{
+			const weight &w = (*net)[i];
+			size_t nz = w.nonzero();
+			out << "\t[" << i << "]\tnonzero = " << nz << " (" << std::fixed << std::setprecision(2) << (w.size() ? nz * 100.0 / w.size() : 0) << "%)";
+			out << ", touched = " << w.touched() << "/" << w.pages() << " pages" << std::endl;
+			nonzero += nz, touched += w.touched(), pages += w.pages(), bytes += w.footprint();
+		}
+		out << "\ttotal\tnonzero = " << nonzero << " (" << (entries ? nonzero * 100.0 / entries : 0) << "%)";
+		out << ", touched = " << touched << "/" << pages << " pages, memory = " << (bytes / 1048576.0) << "MB" << std::endl;
+		out.copyfmt(ff);
+	}
+
 private:
+	style kind;
 	float alpha;
 	std::array<int, 4> opcode;
-	std::vector<weight> net;
+	std::shared_ptr<network> net;
+	int depth;
+
+	// direct-mapped afterstate value cache, invalidated by bumping the version of the network on every update,
+	// where the version is shared by the copies of this player as the network is, see invalidate
+	struct memo
+	{
+		uint64_t key;
+		uint32_t version;
+		float value;
+	};
+	std::vector<memo> cache;
+	std::shared_ptr<std::atomic<uint32_t>> version;
+	uint64_t lookups, hits;
+
+	bool deferred;
+	unsigned flush;
+	size_t episodes;
+
+	// network in shared memory, attached read-only by shm=NAME, or published by publish=NAME every 'interval' episodes
+	// by the player that created the store, see mate
+	std::shared_ptr<shared_weights> store;
+	uint64_t generation;
+	unsigned interval;
+	size_t published;
+	bool publisher;
+
+	// order=auto, see set_order
+	unsigned calibrate;
+	std::vector<std::array<uint64_t, tupleSize>> changes;
+	board last; // the last afterstate played in this episode, if any
+	bool played;
+
+	// heat=PATH: the access counts of the tables in every 'sample'-th episode, shared by the copies of this player
+	std::shared_ptr<heatmap> heat;
+	bool recording;
+
+	// book=PATH: the opening book, shared by the copies of this player
+	std::shared_ptr<book> opening;
+	uint64_t book_lookups, book_hits;
+	size_t book_moves;
 };
 
 /**
  * random environment
- * add a new random tile to an empty cell
- * 2-tile: 90%
- * 4-tile: 10%
+ * add a new random tile to an empty cell, see env_model
+ *
+ * crn: use common random numbers, where each placement is a function of
+ *      (episode seed, step index, empty cells) rather than of a sequential stream,
+ *      so that different players of the same episode seed face correlated tiles
+ *      the episode seeds are drawn from the engine in open_episode
  */
 class rndenv : public random_agent
 {
 public:
 	rndenv(const std::string &args = "") : random_agent("name=random role=environment " + args),
-										   space({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}), popup(0, 9) {}
+										   space({0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15}), popup(0, 9),
+										   crn(false), origin(0), episode_seed(0), steps(0)
+	{
+		if (meta.find("crn") != meta.end())
+			crn = true;
+	}
+
+	virtual void open_episode(const std::string &flag = "")
+	{
+		// each episode is determined by its seed alone, so that it replays, and tournament pairs the same tiles
+		origin = state();
+		reseed(origin);
+		for (int i = 0; i < 16; i++)
+			space[i] = i;
+		if (crn)
+			episode_seed = (uint64_t(engine()) << 32) | engine();
+		steps = 0;
+	}
 
 	virtual action take_action(const board &after)
 	{
+		unsigned empty = after.empty_mask();
+		if (!empty)
+			return action();
+		if (crn)
+			return common_action(empty);
+		// the same draws as before the environment model was shared, so that seeded games are unchanged
 		std::shuffle(space.begin(), space.end(), engine);
 		for (int pos : space)
 		{
 			if (after(pos) != 0)
 				continue;
-			board::cell tile = popup(engine) ? 1 : 2;
+			board::cell tile = env_model::popups()[popup(engine) ? 0 : 1].tile; // 9 in 10, see env_model
 			return action::place(pos, tile);
 		}
 		return action();
 	}
 
+	/**
+	 * the seed of the current episode, with which --evil="seed=..." replays it as the first episode
+	 */
+	unsigned seed() const { return origin; }
+
+protected:
+	/**
+	 * draw 16-bit priorities of all cells from (episode seed, step index),
+	 * and place on the empty cell of the highest priority, which is uniform over the empty cells
+	 * boards with overlapping empty cells thus mostly share the same placement
+	 */
+	action common_action(unsigned empty)
+	{
+		uint64_t step = episode_seed + board::mix(++steps);
+		unsigned pos = 0, best = 0;
+		for (unsigned cells = empty; cells; cells &= cells - 1)
+		{
+			unsigned i = __builtin_ctz(cells);
+			unsigned priority = ((board::mix(step + (i / 4)) >> (16 * (i % 4))) & 0xffff) + 1;
+			if (priority > best)
+				pos = i, best = priority;
+		}
+		float roll = (board::mix(step + 4) & 0xffffffffu) * (1.0f / 4294967296.0f);
+		for (const env_model::popup &p : env_model::popups())
+		{
+			if (roll < p.prob)
+				return action::place(pos, p.tile);
+			roll -= p.prob;
+		}
+		return action::place(pos, env_model::popups().back().tile);
+	}
+
 private:
 	std::array<int, 16> space;
 	std::uniform_int_distribution<int> popup;
+	bool crn;
+	unsigned origin;
+	uint64_t episode_seed;
+	unsigned steps;
+};
+
+/**
+ * adversarial environment
+ * place the tile that minimizes the value of the player, by alpha-beta search
+ * over placements (min nodes) and slides (max nodes), with the player's network at the leaves
+ *
+ * depth=N: the number of player plies to look ahead (1 by default)
+ * budget=T: the time budget per move in milliseconds (unlimited by default),
+ *           the search is iteratively deepened and stops at the last completed depth
+ */
+class evilenv : public agent
+{
+public:
+	evilenv(player &critic, const std::string &args = "") : agent("name=evil role=environment " + args),
+															critic(critic), depth(1), budget(0), nodes(0), timeout(false)
+	{
+		if (meta.find("depth") != meta.end())
+			depth = std::max(int(meta["depth"]), 1);
+		if (meta.find("budget") != meta.end())
+			budget = int(meta["budget"]);
+	}
+
+	virtual action take_action(const board &after)
+	{
+		if (!after.empty_mask())
+			return action();
+		start = std::chrono::steady_clock::now();
+		timeout = false;
+		action best;
+		for (int d = 1; d <= depth; d++)
+		{
+			action found = search_root(after, d, best);
+			if (timeout)
+				break;
+			best = found;
+		}
+		return best;
+	}
+
+protected:
+	/**
+	 * search the placements at the root, trying the best one of the previous iteration first
+	 */
+	action search_root(const board &after, int depth, action first)
+	{
+		action best;
+		float best_value = std::numeric_limits<float>::infinity();
+		auto visit = [&](unsigned pos, board::cell tile)
+		{
+			board next = after;
+			next(pos) = tile;
+			float value = max_node(next, depth, -std::numeric_limits<float>::infinity(), best_value);
+			if (!timeout && (best.type() != action::place::type || value < best_value))
+			{
+				best = action::place(pos, tile);
+				best_value = value;
+			}
+		};
+		if (first.type() == action::place::type)
+			visit(action::place(first).position(), action::place(first).tile());
+		for (unsigned empty = after.empty_mask(); empty && !timeout; empty &= empty - 1)
+		{
+			for (const env_model::popup &p : env_model::popups())
+			{
+				unsigned pos = __builtin_ctz(empty);
+				if (first.type() != action::place::type || action(action::place(pos, p.tile)) != first)
+					visit(pos, p.tile);
+			}
+		}
+		return best;
+	}
+
+	float max_node(const board &before, int depth, float alpha, float beta)
+	{
+		float best = 0;
+		bool moved = false;
+		for (int op = 0; op < 4 && !timeout; op++)
+		{
+			board after = before;
+			board::reward reward = after.slide(op);
+			if (reward == -1)
+				continue;
+			float value = reward + (depth <= 1 ? critic.evaluate(after) : min_node(after, depth - 1, alpha - reward, beta - reward));
+			if (!moved || value > best)
+				best = value;
+			moved = true;
+			alpha = std::max(alpha, value);
+			if (alpha >= beta)
+				break;
+		}
+		return best;
+	}
+
+	float min_node(const board &after, int depth, float alpha, float beta)
+	{
+		if ((++nodes & 1023) == 0 && budget && std::chrono::steady_clock::now() - start > std::chrono::milliseconds(budget))
+			timeout = true;
+		float best = std::numeric_limits<float>::infinity();
+		for (unsigned empty = after.empty_mask(); empty && !timeout; empty &= empty - 1)
+		{
+			board next = after;
+			for (const env_model::popup &p : env_model::popups())
+			{
+				next(__builtin_ctz(empty)) = p.tile;
+				best = std::min(best, max_node(next, depth, alpha, beta));
+				beta = std::min(beta, best);
+				if (alpha >= beta)
+					return best;
+			}
+		}
+		return best;
+	}
+
+private:
+	player &critic;
+	int depth;
+	int budget;
+	uint64_t nodes;
+	bool timeout;
+	std::chrono::steady_clock::time_point start;
 };
@@ -0,0 +1,475 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * bench.cpp: Micro-benchmarks for the components of the framework
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <random>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include <cstdlib>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+#include "weight.h"
+#include "perf.h"
+#include "remote.h"
+
+/**
+ * a player exposing its features, for recording realistic access streams
+ */
+class probe : public player {
+public:
+	probe(const std::string& args) : player(args) {}
+	using player::order;
+
+	static constexpr int tables() { return indexCount; }
+	static size_t length() { return size_t(pow(maxIndex, tupleSize)); }
+
+	/**
+	 * play games and return all afterstates, taken from the slides played rather than from the history,
+	 * which is not recorded by every player (e.g., expectimax with alpha=0)
+	 */
+	std::vector<board> afterstates(size_t games, rndenv& evil) {
+		std::vector<board> boards;
+		for (size_t g = 0; g < games; g++) {
+			episode game;
+			open_episode();
+			evil.open_episode();
+			while (true) {
+				agent& who = game.take_turns(*this, evil);
+				action move = who.take_action(game.state());
+				if (&who == this && move.type() == action::slide::type) {
+					board after = game.state();
+					if (after.slide(move.event()) != -1) boards.push_back(after);
+				}
+				if (game.apply_action(move) != true) break;
+			}
+			history.clear();
+		}
+		if (boards.empty()) {
+			std::cerr << "no afterstates were played, check play=ARGS and games=N" << std::endl;
+			std::exit(1);
+		}
+		return boards;
+	}
+
+	/**
+	 * play games and record the features of all afterstates, as (table, index) pairs
+	 */
+	std::vector<std::pair<uint32_t, uint32_t>> record(size_t games, rndenv& evil) {
+		std::vector<std::pair<uint32_t, uint32_t>> stream;
+		for (size_t g = 0; g < games; g++) {
+			episode game;
+			open_episode();
+			evil.open_episode();
+			while (true) {
+				agent& who = game.take_turns(*this, evil);
+				if (game.apply_action(who.take_action(game.state())) != true) break;
+			}
+			close_episode();
+			for (const step& s : history)
+				for (int x = 0; x < indexCount; x++)
+					stream.emplace_back(x, extract_feature(s.after, x));
+		}
+		return stream;
+	}
+};
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * concurrent TD updates on shared weight tables
+ * every thread replays the same recorded stream and adds 1 per update,
+ * so that the lost updates are exactly the shortfall of the table sums
+ */
+static void bench_weight(std::map<std::string, std::string>& opt) {
+	size_t threads = std::stoull(opt["threads"]);
+	size_t games = std::stoull(opt["games"]);
+	probe play("name=TD alpha=0 seed=1 " + opt["play"]);
+	rndenv evil("seed=1");
+	auto stream = play.record(games, evil);
+	std::cout << "stream: " << games << " games, " << stream.size() << " updates per thread, " << threads << " threads" << std::endl;
+
+	std::vector<weight> net;
+	for (int i = 0; i < probe::tables(); i++) net.emplace_back(probe::length());
+	for (std::string mode : { "plain", "atomic", "striped", "delta" }) {
+		for (weight& w : net) {
+			w = weight(w.size());
+			w.mode(mode == "delta" ? weight::atomic : weight::parse(mode));
+		}
+		auto start = std::chrono::steady_clock::now();
+		std::vector<std::thread> pool;
+		for (size_t t = 0; t < threads; t++) {
+			pool.emplace_back([&]() {
+				if (mode != "delta") {
+					for (auto& u : stream) net[u.first].update(u.second, 1);
+					return;
+				}
+				std::vector<std::pair<uint32_t, uint32_t>> local;
+				for (size_t i = 0; i < stream.size(); i++) {
+					local.push_back(stream[i]);
+					if (local.size() == 65536 || i + 1 == stream.size()) {
+						std::sort(local.begin(), local.end());
+						for (size_t k = 0, j; k < local.size(); k = j) {
+							for (j = k; j < local.size() && local[j] == local[k]; j++);
+							net[local[k].first].update(local[k].second, j - k);
+						}
+						local.clear();
+					}
+				}
+			});
+		}
+		for (std::thread& t : pool) t.join();
+		double elapsed = seconds_since(start);
+
+		double sum = 0;
+		for (weight& w : net)
+			for (size_t i = 0; i < w.size(); i++) sum += w[i];
+		double expect = double(stream.size()) * threads;
+		std::cout << std::left << std::setw(8) << mode << std::right;
+		std::cout << "\t" << std::fixed << std::setprecision(0) << (expect / elapsed) << " updates/s";
+		std::cout << "\t" << std::setprecision(4) << ((expect - sum) * 100 / expect) << "% lost" << std::endl;
+	}
+}
+
+/**
+ * lookups and updates on the flat and the compact table layouts, replaying a recorded stream
+ * the tables are loaded from play=load=PATH, and the compact layouts are indexed by 1 to 3 leading cells
+ */
+static void bench_layout(std::map<std::string, std::string>& opt) {
+	size_t games = std::stoull(opt["games"]);
+	probe play("name=TD alpha=0 seed=1 " + opt["play"]);
+	rndenv evil("seed=1");
+	auto stream = play.record(games, evil);
+	std::cout << "stream: " << games << " games, " << stream.size() << " lookups" << std::endl;
+	if (!play.weights()) return;
+
+	perf& counter = perf::counters();
+	counter.open();
+	const size_t block[] = { 0, 25 * 25 * 25, 25 * 25, 25 };
+	for (int prefix = 0; prefix < 4; prefix++) {
+		std::vector<weight> net(*play.weights());
+		size_t bytes = 0;
+		for (weight& w : net) {
+			if (prefix) w.compact(block[prefix]);
+			bytes += w.footprint();
+		}
+		const std::vector<weight>& tables = net;
+		double sum = 0;
+		counter.enter(perf::player);
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < 10; r++)
+			for (auto& u : stream) sum += tables[u.first][u.second];
+		double lookup = seconds_since(start);
+		counter.leave(perf::player);
+		counter.enter(perf::update);
+		start = std::chrono::steady_clock::now();
+		for (auto& u : stream) net[u.first].update(u.second, 0);
+		double update = seconds_since(start);
+		counter.leave(perf::update);
+
+		std::cout << (prefix ? "compact/" + std::to_string(prefix) : std::string("flat")) << std::fixed;
+		std::cout << "\t" << std::setprecision(2) << (bytes / 1048576.0) << "MB";
+		std::cout << "\t" << std::setprecision(0) << (stream.size() * 10 / lookup) << " lookups/s";
+		std::cout << "\t" << (stream.size() / update) << " updates/s";
+		std::cout << "\t(sum = " << std::setprecision(2) << sum << ")" << std::endl;
+		counter.report(std::cout);
+	}
+}
+
+/**
+ * locality of the table index orders, see player::set_order
+ * for each order, the fraction of lookups hitting the same cache line as the previous lookup of the same table,
+ * and the lookup rate replaying the stream of afterstates
+ */
+static void bench_order(std::map<std::string, std::string>& opt) {
+	size_t games = std::stoull(opt["games"]);
+	probe calib("name=TD alpha=0 seed=1 order=auto calibrate=" + opt["games"] + " " + opt["play"]);
+	rndenv env("seed=1");
+	calib.record(games, env);
+	for (std::string order : { std::string("0123"), std::string("3210"), calib.order() }) {
+		probe play("name=TD alpha=0 seed=1 order=" + order + " " + opt["play"]);
+		rndenv evil("seed=1");
+		auto stream = play.record(games, evil);
+		if (!play.weights()) return;
+		const std::vector<weight>& tables = *play.weights();
+
+		std::vector<int64_t> last(probe::tables(), -1);
+		size_t near = 0;
+		for (auto& u : stream) {
+			int64_t line = u.second * sizeof(weight::type) / 64;
+			near += (last[u.first] == line);
+			last[u.first] = line;
+		}
+		double sum = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int r = 0; r < 10; r++)
+			for (auto& u : stream) sum += tables[u.first][u.second];
+		double elapsed = seconds_since(start);
+
+		std::cout << order << std::fixed;
+		std::cout << "\t" << std::setprecision(2) << (near * 100.0 / stream.size()) << "% same line";
+		std::cout << "\t" << std::setprecision(0) << (stream.size() * 10 / elapsed) << " lookups/s";
+		std::cout << "\t(sum = " << std::setprecision(2) << sum << ")" << std::endl;
+	}
+}
+
+/**
+ * the scalar slide of a direction, composed as in board::slide
+ */
+static board::reward reference(board& b, unsigned op) {
+	board::reward score;
+	switch (op) {
+	case 0: b.rotate_right(); b.reflect_horizontal(); score = b.slide_left_scalar(); b.reflect_horizontal(); b.rotate_left(); break;
+	case 1: b.reflect_horizontal(); score = b.slide_left_scalar(); b.reflect_horizontal(); break;
+	case 2: b.rotate_right(); score = b.slide_left_scalar(); b.rotate_left(); break;
+	default: score = b.slide_left_scalar(); break;
+	}
+	return score;
+}
+
+/**
+ * exhaustive check of board::slide_each against the scalar slide_left, over all rows of tiles below 'tiles'
+ * the k-th board consists of the rows k to k+3, so that every row is placed in every row of a board,
+ * then the speed of slide_each is compared with four calls of slide
+ */
+static void bench_slide(std::map<std::string, std::string>& opt) {
+	unsigned tiles = std::stoul(opt["tiles"]);
+	size_t rows = size_t(tiles) * tiles * tiles * tiles;
+	auto make = [&](size_t k) {
+		board b;
+		for (int r = 0; r < 4; r++)
+			for (size_t c = 0, x = (k + r) % rows; c < 4; c++, x /= tiles) b[r][c] = x % tiles;
+		return b;
+	};
+	size_t mismatch = 0;
+	for (size_t k = 0; k < rows; k++) {
+		board before = make(k), after[4];
+		board::reward score[4];
+		board::slide_each(before, after, score);
+		for (unsigned op = 0; op < 4; op++) {
+			board expect = before;
+			board::reward reward = reference(expect, op);
+			if (reward != score[op] || (reward != -1 && expect != after[op])) {
+				if (mismatch++ < 4) std::cout << "mismatch: op = " << op << ", reward = " << score[op] << " vs " << reward << std::endl << before;
+			}
+		}
+	}
+	std::cout << "slide: " << rows << " rows of tiles below " << tiles << " in all rows and directions, " << mismatch << " mismatches" << std::endl;
+
+	std::vector<board> boards;
+	for (size_t k = 0; k < rows; k += 7) boards.push_back(make(k));
+	board::reward sum = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (const board& before : boards) {
+		board after[4];
+		board::reward score[4];
+		board::slide_each(before, after, score);
+		sum += score[0] + score[1] + score[2] + score[3];
+	}
+	double each = seconds_since(start);
+	start = std::chrono::steady_clock::now();
+	for (const board& before : boards) {
+		for (unsigned op = 0; op < 4; op++) {
+			board after = before;
+			sum -= after.slide(op);
+		}
+	}
+	double four = seconds_since(start);
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "slide_each\t" << (boards.size() / each) << " boards/s" << std::endl;
+	std::cout << "slide x 4\t" << (boards.size() / four) << " boards/s" << std::endl;
+	if (sum != 0) std::cout << "the rewards differ" << std::endl;
+}
+
+/**
+ * the cost of constructing agents, as for short-lived agents of parallel evaluations and tournaments
+ * the pairs printed by the verbose constructions are discarded, so that only their formatting is counted,
+ * and the cost of a move of a player without weights shows the per-move overhead of the options
+ */
+static void bench_agent(std::map<std::string, std::string>& opt) {
+	size_t count = std::stoull(opt["agents"]);
+	std::stringstream sink;
+	std::streambuf* out = std::cout.rdbuf(sink.rdbuf());
+	auto time = [&](std::function<void()> make) {
+		auto start = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < count; i++) make();
+		return seconds_since(start) * 1e9 / count;
+	};
+	std::vector<std::pair<std::string, double>> results;
+	for (std::string quiet : { "", " quiet" }) {
+		results.emplace_back("rndenv" + quiet, time([&]() { rndenv evil("seed=1" + quiet); }));
+		results.emplace_back("player" + quiet, time([&]() { player play("name=TD alpha=0 seed=1 depth=1" + quiet); }));
+	}
+	player shared("name=TD alpha=0 quiet init");
+	results.emplace_back("player copy", time([&]() { player play(shared); }));
+	std::cout.rdbuf(out);
+	for (auto& r : results) std::cout << r.first << "\t" << std::fixed << std::setprecision(0) << r.second << " ns" << std::endl;
+
+	player greedy("name=greedy_score alpha=0 quiet seed=1");
+	agent& play = greedy;
+	board b;
+	b(0) = b(5) = 1;
+	size_t moves = count * 10;
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < moves; i++) b.info(play.take_action(b).event());
+	std::cout << "take_action\t" << std::setprecision(1) << (seconds_since(start) * 1e9 / moves) << " ns (greedy_score)" << std::endl;
+}
+
+/**
+ * clients of the evaluation service (see service.h) at socket=PATH, started by 2584 --eval-serve=PATH with the same play=ARGS
+ * each of the 'clients' threads sends 'requests' requests of 'size' afterstates in turn, op=V for values or op=M for moves,
+ * the answers of the first request of each client are checked against a local player, then the latency is shown
+ */
+static void bench_eval(std::map<std::string, std::string>& opt) {
+	size_t clients = std::stoull(opt["clients"]), requests = std::stoull(opt["requests"]), size = std::stoull(opt["size"]);
+	uint32_t op = opt["op"] == "M" ? 'M' : 'V';
+	probe play("name=TD alpha=0 seed=1 quiet " + opt["play"]);
+	rndenv evil("seed=1 quiet");
+	std::vector<board> boards = play.afterstates(std::stoull(opt["games"]), evil);
+	std::cout << "eval: " << boards.size() << " afterstates, " << clients << " clients x " << requests << " requests of " << size << " boards" << std::endl;
+
+	std::unique_ptr<channel> control = channel::connect(opt["socket"]); // keeps the service up until the metrics are read
+	std::vector<double> latency;
+	std::mutex lock;
+	std::atomic<size_t> wrong(0);
+	auto start = std::chrono::steady_clock::now();
+	std::vector<std::thread> pool;
+	for (size_t c = 0; c < clients; c++) {
+		pool.emplace_back([&, c]() {
+			std::unique_ptr<channel> link = channel::connect(opt["socket"]);
+			player local(play);
+			agent& mover = local;
+			std::vector<uint8_t> bytes(size * 16);
+			std::vector<float> values(size * 2);
+			std::vector<double> mine;
+			for (size_t r = 0; r < requests; r++) {
+				size_t first = ((c * requests + r) * size) % boards.size();
+				for (size_t i = 0; i < size; i++)
+					for (int k = 0; k < 16; k++) bytes[i * 16 + k] = boards[(first + i) % boards.size()](k);
+				auto since = std::chrono::steady_clock::now();
+				channel::header head = { op, 0, size };
+				if (!link->send(&head, sizeof(head)) || !link->send(bytes.data(), bytes.size()) ||
+					!link->recv(&head, sizeof(head)) || !link->recv(values.data(), (op == 'M' ? 8 : 4) * size)) {
+					std::cerr << "lost connection to the service" << std::endl;
+					return;
+				}
+				mine.push_back(seconds_since(since) * 1e6);
+				for (size_t i = 0; r == 0 && i < size; i++) {
+					const board& b = boards[(first + i) % boards.size()];
+					if (op == 'V') {
+						wrong += (values[i] != local.evaluate(b));
+					} else {
+						int32_t code;
+						std::memcpy(&code, &values[i * 2], sizeof(code));
+						action move = mover.take_action(b);
+						wrong += (code != (move.type() == action::slide::type ? int32_t(move.event() & 3) : -1));
+					}
+				}
+			}
+			std::lock_guard<std::mutex> guard(lock);
+			latency.insert(latency.end(), mine.begin(), mine.end());
+		});
+	}
+	for (std::thread& t : pool) t.join();
+	double elapsed = seconds_since(start);
+
+	std::sort(latency.begin(), latency.end());
+	auto at = [&](double p) { return latency.empty() ? 0 : latency[std::min(latency.size() - 1, size_t(p * latency.size()))]; };
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "client: " << (latency.size() * size / elapsed) << " boards/s, latency = " << at(0.5) << "/" << at(0.9) << "/" << at(0.99);
+	std::cout << " us 50/90/99%, " << wrong << " mismatches" << std::endl;
+
+	channel::header head = { 'S', 0, 0 };
+	std::string text;
+	if (control->send(&head, sizeof(head)) && control->recv(&head, sizeof(head))) {
+		text.resize(head.size);
+		control->recv(&text[0], text.size());
+	}
+	std::cout << "server: " << text << std::endl;
+}
+
+/**
+ * the values of afterstates one by one (player::evaluate) against table by table in batches of 'size'
+ */
+static void bench_batch(std::map<std::string, std::string>& opt) {
+	size_t size = std::stoull(opt["size"]);
+	probe play("name=TD alpha=0 seed=1 quiet " + opt["play"]);
+	rndenv evil("seed=1 quiet");
+	std::vector<board> boards = play.afterstates(std::stoull(opt["games"]), evil);
+	std::shuffle(boards.begin(), boards.end(), std::default_random_engine(1));
+	std::vector<float> one(boards.size()), many(boards.size());
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < boards.size(); i++) one[i] = play.evaluate(boards[i]);
+	double single = seconds_since(start);
+	start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < boards.size(); i += size)
+		play.evaluate(&boards[i], &many[i], std::min(size, boards.size() - i));
+	double batched = seconds_since(start);
+	std::cout << std::fixed << std::setprecision(0);
+	std::cout << "one by one\t" << (boards.size() / single) << " boards/s" << std::endl;
+	std::cout << "batch of " << size << "\t" << (boards.size() / batched) << " boards/s";
+	std::cout << (one == many ? "" : " (the values differ)") << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+	if (argc < 2) {
+		std::cerr << "usage: " << argv[0] << " weight|layout|order|slide|agent|eval|batch [threads=N] [games=N] [play=ARGS]" << std::endl;
+		return 1;
+	}
+	std::string which(argv[1]);
+	std::map<std::string, std::string> opt = {
+		{ "threads", std::to_string(std::max(std::thread::hardware_concurrency(), 1u)) },
+		{ "games", "20" },
+		{ "play", "init" },
+		{ "tiles", "20" },
+		{ "agents", "100000" },
+		{ "socket", "/tmp/2584-eval.sock" },
+		{ "clients", "4" },
+		{ "requests", "1000" },
+		{ "size", "256" },
+		{ "op", "V" },
+	};
+	for (int i = 2; i < argc; i++) {
+		std::string pair(argv[i]);
+		opt[pair.substr(0, pair.find('='))] = pair.substr(pair.find('=') + 1);
+	}
+
+	if (which == "weight") {
+		bench_weight(opt);
+	} else if (which == "layout") {
+		bench_layout(opt);
+	} else if (which == "order") {
+		bench_order(opt);
+	} else if (which == "slide") {
+		bench_slide(opt);
+	} else if (which == "agent") {
+		bench_agent(opt);
+	} else if (which == "eval") {
+		bench_eval(opt);
+	} else if (which == "batch") {
+		bench_batch(opt);
+	} else {
+		std::cerr << which << " is not a valid benchmark" << std::endl;
+		return 1;
+	}
+	return 0;
+}
@@ -13,6 +13,13 @@
 #include <iomanip>
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#if defined(BOARD8)
+#include <tmmintrin.h>
+#endif
+#if defined(BOARD8) && defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 /**
  * array-based board for 2048
@@ -23,14 +30,25 @@
  *  (8)  (9) (10) (11)
  * (12) (13) (14) (15)
  *
+ * building with -DBOARD8 (and at least -mssse3) stores the tiles as bytes,
+ * so that the 16 tiles fit in one SSE register, and slides and comparisons become byte shuffles
  */
 class board {
 public:
+#if defined(BOARD8)
+	typedef uint8_t cell;
+#else
 	typedef uint32_t cell;
+#endif
 	typedef std::array<cell, 4> row;
 	typedef std::array<row, 4> grid;
 	typedef uint64_t data;
-	typedef int reward;
+	typedef int64_t reward;
+
+	/**
+	 * the number of tile indices with distinct values, where fibb(tiles - 1) is the largest Fibonacci number of 64 bits
+	 */
+	static const unsigned tiles = 94;
 
 public:
 	board() : tile(), attr(0) {}
@@ -49,7 +67,11 @@ public:
 	data info(data dat) { data old = attr; attr = dat; return old; }
 
 public:
+#if defined(BOARD8)
+	bool operator ==(const board& b) const { return _mm_movemask_epi8(_mm_cmpeq_epi8(load(), b.load())) == 0xffff; }
+#else
 	bool operator ==(const board& b) const { return tile == b.tile; }
+#endif
 	bool operator < (const board& b) const { return tile <  b.tile; }
 	bool operator !=(const board& b) const { return !(*this == b); }
 	bool operator > (const board& b) const { return b < *this; }
@@ -83,10 +105,81 @@ public:
 		}
 	}
 	
-	static uint32_t fibb(unsigned index) {
-		if(index < 3)
-			return 1;
-		return fibb(index - 1) + fibb(index - 2);
+	/**
+	 * the afterstates and the rewards of all four slides of a board, as after[op] = before, after[op].slide(op)
+	 * with -DBOARD8 and AVX2, the four boards are slid as two pairs of 128-bit lanes, see slide_left_avx2
+	 */
+	static void slide_each(const board& before, board after[4], reward score[4]) {
+#if defined(BOARD8) && defined(__AVX2__)
+		// map up, right, down, left into left slides, then map back
+		const __m256i forward_ur = _mm256_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15,
+				3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+		const __m256i forward_dl = _mm256_setr_epi8(12, 8, 4, 0, 13, 9, 5, 1, 14, 10, 6, 2, 15, 11, 7, 3,
+				0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		const __m256i inverse_dl = _mm256_setr_epi8(3, 7, 11, 15, 2, 6, 10, 14, 1, 5, 9, 13, 0, 4, 8, 12,
+				0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+		__m256i both = _mm256_broadcastsi128_si256(before.load());
+		__m256i ur = slide_left_avx2(_mm256_shuffle_epi8(both, forward_ur), score[0], score[1]);
+		__m256i dl = slide_left_avx2(_mm256_shuffle_epi8(both, forward_dl), score[2], score[3]);
+		ur = _mm256_shuffle_epi8(ur, forward_ur); // both are involutions
+		dl = _mm256_shuffle_epi8(dl, inverse_dl);
+		after[0] = after[1] = after[2] = after[3] = before;
+		after[0].store(_mm256_castsi256_si128(ur));
+		after[1].store(_mm256_extracti128_si256(ur, 1));
+		after[2].store(_mm256_castsi256_si128(dl));
+		after[3].store(_mm256_extracti128_si256(dl, 1));
+#else
+		for (unsigned op = 0; op < 4; op++) {
+			after[op] = before;
+			score[op] = after[op].slide(op);
+		}
+#endif
+	}
+
+	/**
+	 * the index-th Fibonacci number (1, 1, 2, 3, 5, ...), saturated at fibb(tiles - 1)
+	 * note that the tile of index t is worth fibb(t + 1)
+	 */
+	static uint64_t fibb(unsigned index) {
+		static const struct table {
+			uint64_t value[tiles];
+			table() {
+				value[0] = value[1] = value[2] = 1;
+				for (unsigned i = 3; i < tiles; i++) value[i] = value[i - 1] + value[i - 2];
+			}
+		} fib;
+		return fib.value[std::min(index, tiles - 1)];
+	}
+
+	/**
+	 * 64-bit hash of the tiles (the attribute is not included)
+	 */
+	uint64_t hash() const {
+		uint64_t hi = 0, lo = 0;
+		for (int i = 0; i < 8; i++) {
+			hi = (hi << 8) | operator()(i);
+			lo = (lo << 8) | operator()(i + 8);
+		}
+		return mix(mix(hi) ^ lo);
+	}
+
+	/**
+	 * 64-bit finalizer of splitmix64
+	 */
+	static uint64_t mix(uint64_t h) {
+		h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+		h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+		return h ^ (h >> 31);
+	}
+
+	/**
+	 * bit mask of the empty cells, bit i is set if cell (i) is empty
+	 */
+	unsigned empty_mask() const {
+		unsigned mask = 0;
+		for (int i = 0; i < 16; i++)
+			mask |= unsigned(operator()(i) == 0) << i;
+		return mask;
 	}
 
 	unsigned space_left() {
@@ -99,6 +192,17 @@ public:
 	}
 
 	reward slide_left() {
+#if defined(BOARD8)
+		return slide_left_sse();
+#else
+		return slide_left_scalar();
+#endif
+	}
+
+	/**
+	 * the reference implementation of slide_left
+	 */
+	reward slide_left_scalar() {
 		board prev = *this;
 		reward score = 0;
 		for (int r = 0; r < 4; r++) {
@@ -145,6 +249,123 @@ public:
 		return score;
 	}
 
+#if defined(BOARD8)
+	/**
+	 * slide all rows at once:
+	 * compact the tiles of each row by pshufb, find the mergeable neighbors by pcmpeqb,
+	 * resolve the left-to-right priority of merges, merge, then compact again
+	 */
+	reward slide_left_sse() {
+		const __m128i zero = _mm_setzero_si128(), one = _mm_set1_epi8(1);
+		const __m128i lane012 = _mm_set1_epi32(0x00ffffff), lane123 = _mm_set1_epi32(0xffffff00), lane23 = _mm_set1_epi32(0xffff0000);
+		__m128i prev = load();
+		__m128i v = compact(prev);
+		__m128i next = _mm_and_si128(_mm_srli_si128(v, 1), lane012);
+		__m128i pair = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_add_epi8(next, one)), _mm_cmpeq_epi8(next, _mm_add_epi8(v, one))),
+				_mm_and_si128(_mm_cmpeq_epi8(v, one), _mm_cmpeq_epi8(next, one)));
+		pair = _mm_andnot_si128(_mm_cmpeq_epi8(next, zero), pair);
+		// merge at lane i if mergeable, unless lane i - 1 merged, i.e., p[i] & ~(p[i-1] & ~p[i-2])
+		__m128i left1 = _mm_and_si128(_mm_slli_si128(pair, 1), lane123);
+		__m128i left2 = _mm_and_si128(_mm_slli_si128(pair, 2), lane23);
+		__m128i merge = _mm_andnot_si128(_mm_andnot_si128(left2, left1), pair);
+		__m128i merged = _mm_add_epi8(_mm_max_epu8(v, next), one);
+		v = _mm_or_si128(_mm_and_si128(merge, merged), _mm_andnot_si128(merge, v));
+		v = _mm_andnot_si128(_mm_and_si128(_mm_slli_si128(merge, 1), lane123), v);
+		reward score = 0;
+		unsigned mask = _mm_movemask_epi8(merge);
+		if (mask) {
+			alignas(16) uint8_t value[16];
+			_mm_store_si128(reinterpret_cast<__m128i*>(value), merged);
+			for (; mask; mask &= mask - 1) score += fibb(value[__builtin_ctz(mask)]);
+		}
+		v = compact(v);
+		store(v);
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(prev, v)) != 0xffff ? score : -1;
+	}
+
+#if defined(__AVX2__)
+	/**
+	 * slide_left_sse of two boards, one per 128-bit lane, where in-lane byte shifts and shuffles
+	 * keep the rows of the boards apart, and the rewards are -1 if the board is unchanged
+	 */
+	static __m256i slide_left_avx2(__m256i prev, reward& low, reward& high) {
+		const __m256i zero = _mm256_setzero_si256(), one = _mm256_set1_epi8(1);
+		const __m256i lane012 = _mm256_set1_epi32(0x00ffffff), lane123 = _mm256_set1_epi32(0xffffff00), lane23 = _mm256_set1_epi32(0xffff0000);
+		__m256i v = compact(prev);
+		__m256i next = _mm256_and_si256(_mm256_srli_si256(v, 1), lane012);
+		__m256i pair = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_add_epi8(next, one)), _mm256_cmpeq_epi8(next, _mm256_add_epi8(v, one))),
+				_mm256_and_si256(_mm256_cmpeq_epi8(v, one), _mm256_cmpeq_epi8(next, one)));
+		pair = _mm256_andnot_si256(_mm256_cmpeq_epi8(next, zero), pair);
+		__m256i left1 = _mm256_and_si256(_mm256_slli_si256(pair, 1), lane123);
+		__m256i left2 = _mm256_and_si256(_mm256_slli_si256(pair, 2), lane23);
+		__m256i merge = _mm256_andnot_si256(_mm256_andnot_si256(left2, left1), pair);
+		__m256i merged = _mm256_add_epi8(_mm256_max_epu8(v, next), one);
+		v = _mm256_blendv_epi8(v, merged, merge);
+		v = _mm256_andnot_si256(_mm256_and_si256(_mm256_slli_si256(merge, 1), lane123), v);
+		low = high = 0;
+		unsigned mask = _mm256_movemask_epi8(merge);
+		if (mask) {
+			alignas(32) uint8_t value[32];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(value), merged);
+			for (; mask; mask &= mask - 1) {
+				unsigned i = __builtin_ctz(mask);
+				(i < 16 ? low : high) += fibb(value[i]);
+			}
+		}
+		v = compact(v);
+		unsigned same = _mm256_movemask_epi8(_mm256_cmpeq_epi8(prev, v));
+		if ((same & 0xffff) == 0xffff) low = -1;
+		if ((same >> 16) == 0xffff) high = -1;
+		return v;
+	}
+#endif
+
+	void transpose() { permute(_mm_setr_epi8(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15)); }
+	void reflect_horizontal() { permute(_mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12)); }
+	void reflect_vertical() { permute(_mm_setr_epi8(12, 13, 14, 15, 8, 9, 10, 11, 4, 5, 6, 7, 0, 1, 2, 3)); }
+
+private:
+	static_assert(sizeof(grid) == 16, "the tiles must fit in one SSE register");
+	__m128i load() const { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(&tile)); }
+	void store(__m128i v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(&tile), v); }
+	void permute(__m128i order) { store(_mm_shuffle_epi8(load(), order)); }
+
+	/**
+	 * the shuffle moving the nonzero tiles of a row to the left, by the 4-bit mask of the nonzero tiles,
+	 * where 0x80 yields zero
+	 */
+	static const uint32_t* row_order() {
+		static const uint32_t order[16] = {
+			0x80808080, 0x80808000, 0x80808001, 0x80800100, 0x80808002, 0x80800200, 0x80800201, 0x80020100,
+			0x80808003, 0x80800300, 0x80800301, 0x80030100, 0x80800302, 0x80030200, 0x80030201, 0x03020100,
+		};
+		return order;
+	}
+
+	/**
+	 * move the nonzero tiles of each row to the left, keeping their order
+	 */
+	static __m128i compact(__m128i v) {
+		const uint32_t* order = row_order();
+		unsigned live = ~_mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_setzero_si128()));
+		__m128i shuffle = _mm_set_epi32(order[(live >> 12) & 15] + 0x0c0c0c0c, order[(live >> 8) & 15] + 0x08080808,
+				order[(live >> 4) & 15] + 0x04040404, order[live & 15]);
+		return _mm_shuffle_epi8(v, shuffle);
+	}
+#if defined(__AVX2__)
+	static __m256i compact(__m256i v) {
+		const uint32_t* order = row_order();
+		unsigned live = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+		__m256i shuffle = _mm256_setr_epi32(order[live & 15], order[(live >> 4) & 15] + 0x04040404,
+				order[(live >> 8) & 15] + 0x08080808, order[(live >> 12) & 15] + 0x0c0c0c0c,
+				order[(live >> 16) & 15], order[(live >> 20) & 15] + 0x04040404,
+				order[(live >> 24) & 15] + 0x08080808, order[(live >> 28) & 15] + 0x0c0c0c0c);
+		return _mm256_shuffle_epi8(v, shuffle);
+	}
+#endif
+
+public:
+#else
 	void transpose() {
 		for (int r = 0; r < 4; r++) {
 			for (int c = r + 1; c < 4; c++) {
@@ -166,6 +387,7 @@ public:
 			std::swap(tile[1][c], tile[2][c]);
 		}
 	}
+#endif
 
 	/**
 	 * rotate the board clockwise by given times
@@ -198,8 +420,9 @@ public:
 	friend std::istream& operator >>(std::istream& in, board& b) {
 		for (int i = 0; i < 16; i++) {
 			while (!std::isdigit(in.peek()) && in.good()) in.ignore(1);
-			in >> b(i);
-			b(i) = std::log2(b(i));
+			unsigned value = 0;
+			in >> value;
+			b(i) = std::log2(value);
 		}
 		return in;
 	}
@@ -0,0 +1,188 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * book.h: Opening book of precomputed moves for frequent early positions
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include "board.h"
+#include "action.h"
+
+/**
+ * open-addressing hash table from boards to moves
+ *
+ * each entry is a 64-bit word, the board hash with the low 2 bits replaced by the opcode, or 0 if empty,
+ * so that a lookup probes a few consecutive words from hash & mask
+ * boards whose hashes differ only in the low 2 bits are indistinguishable, which is negligible for a book
+ */
+class book {
+public:
+	book(size_t positions = 0, size_t moves = 0) : count(0), moves(moves) { reserve(positions); }
+
+	/**
+	 * the opcode of the board, or -1 if the board is not in the book
+	 */
+	int find(const board& b) const {
+		if (table.empty()) return -1;
+		uint64_t key = tag(b.hash());
+		for (size_t i = key & mask;; i = (i + 1) & mask) {
+			uint64_t entry = table[i];
+			if (entry == 0) return -1;
+			if ((entry & ~uint64_t(3)) == key) return entry & 3;
+		}
+	}
+
+	void insert(const board& b, unsigned op) {
+		if ((count + 1) * 2 > table.size()) reserve(std::max<size_t>(count * 2, 16));
+		uint64_t key = tag(b.hash());
+		size_t i = key & mask;
+		for (; table[i] && (table[i] & ~uint64_t(3)) != key; i = (i + 1) & mask);
+		count += (table[i] == 0);
+		table[i] = key | (op & 3);
+	}
+
+	size_t size() const { return count; }
+
+	/**
+	 * the positions are taken from the first 'depth' slides of episodes, so later lookups can be skipped
+	 */
+	size_t depth() const { return moves; }
+
+	/**
+	 * the file is the uint64 depth, the uint64 number of entries, then the entries
+	 */
+	bool save(const std::string& path) const {
+		std::ofstream out(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		uint64_t depth = moves, length = table.size();
+		out.write(reinterpret_cast<const char*>(&depth), sizeof(depth));
+		out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+		out.write(reinterpret_cast<const char*>(table.data()), sizeof(uint64_t) * length);
+		return bool(out);
+	}
+	bool load(const std::string& path) {
+		std::ifstream in(path, std::ios::in | std::ios::binary);
+		if (!in.is_open()) return false;
+		uint64_t depth = 0, length = 0;
+		in.read(reinterpret_cast<char*>(&depth), sizeof(depth));
+		in.read(reinterpret_cast<char*>(&length), sizeof(length));
+		if (length & (length - 1)) return false;
+		moves = depth;
+		table.assign(length, 0);
+		in.read(reinterpret_cast<char*>(table.data()), sizeof(uint64_t) * length);
+		mask = length - 1;
+		count = std::count_if(table.begin(), table.end(), [](uint64_t e) { return e != 0; });
+		return bool(in);
+	}
+
+private:
+	static uint64_t tag(uint64_t hash) {
+		hash &= ~uint64_t(3);
+		return hash ? hash : 4;
+	}
+
+	/**
+	 * grow to a power of two of at least twice the positions, keeping the entries
+	 */
+	void reserve(size_t positions) {
+		size_t length = 16;
+		while (length < positions * 2) length <<= 1;
+		if (length <= table.size()) return;
+		std::vector<uint64_t> old;
+		old.swap(table);
+		table.assign(length, 0);
+		mask = length - 1;
+		for (uint64_t entry : old) {
+			if (!entry) continue;
+			size_t i = entry & mask;
+			for (; table[i]; i = (i + 1) & mask);
+			table[i] = entry;
+		}
+	}
+
+private:
+	std::vector<uint64_t> table;
+	size_t mask;
+	size_t count;
+	size_t moves;
+};
+
+/**
+ * collects the positions before the first 'moves' slides of logged episodes,
+ * then solves the most frequent ones into a book
+ */
+class book_builder {
+public:
+	book_builder(size_t moves = 32) : moves(moves) {}
+
+	size_t depth() const { return moves; }
+
+	/**
+	 * replay the actions of an episode, see episode::actions
+	 */
+	void collect(const std::vector<action>& actions) {
+		board state;
+		size_t slides = 0;
+		for (const action& move : actions) {
+			if (move.type() == action::slide::type) {
+				if (slides++ >= moves) break;
+				auto& seen = positions[state.hash()];
+				seen.first = state;
+				seen.second++;
+			}
+			if (move.apply(state) == -1) break;
+		}
+	}
+
+	size_t distinct() const { return positions.size(); }
+
+	/**
+	 * solve the 'size' most frequent positions by the agents made by 'solver' (one per thread),
+	 * whose take_action chooses the move, e.g., a deep expectimax player
+	 * return the fraction of the collected positions covered by the book
+	 */
+	template<typename factory>
+	double solve(book& out, size_t size, size_t threads, factory solver) {
+		std::vector<std::pair<size_t, board>> top;
+		uint64_t total = 0, covered = 0;
+		for (auto& p : positions) top.emplace_back(p.second.second, p.second.first), total += p.second.second;
+		size = std::min(size, top.size());
+		std::partial_sort(top.begin(), top.begin() + size, top.end(),
+				[](const std::pair<size_t, board>& a, const std::pair<size_t, board>& b) { return a.first > b.first; });
+		std::vector<int> ops(size, -1);
+		std::atomic<size_t> next(0);
+		auto work = [&]() {
+			auto agent = solver();
+			for (size_t i; (i = next++) < size; ) {
+				action move = agent->take_action(top[i].second);
+				if (move.type() == action::slide::type) ops[i] = move.event() & 3;
+			}
+		};
+		std::vector<std::thread> pool;
+		for (size_t t = 1; t < threads; t++) pool.emplace_back(work);
+		work();
+		for (std::thread& t : pool) t.join();
+		for (size_t i = 0; i < size; i++) {
+			if (ops[i] < 0) continue;
+			out.insert(top[i].second, ops[i]);
+			covered += top[i].first;
+		}
+		return total ? double(covered) / total : 0;
+	}
+
+private:
+	size_t moves;
+	std::unordered_map<uint64_t, std::pair<board, size_t>> positions;
+};
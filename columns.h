@@ -0,0 +1,296 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * columns.h: Streaming columnar writers (Arrow IPC stream or typed CSV) for offline analysis
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+
+/**
+ * a table of integer columns written row by row, where only the rows of the current batch are kept
+ *
+ * the format follows the extension of the path:
+ * .arrow or .arrows: the Arrow IPC streaming format, i.e., a schema message, then a record batch of
+ *   at most 'batch' rows at a time, then the end-of-stream marker, readable by pyarrow.ipc.open_stream,
+ *   duckdb (arrow extension), or pandas through pyarrow
+ * otherwise: CSV with a typed header, e.g., score:int64,tile:uint8, one line per row
+ */
+class columns {
+public:
+	struct column {
+		std::string name;
+		unsigned bits; // 8, 16, 32, or 64
+		bool is_signed;
+	};
+	typedef std::vector<column> schema;
+
+	static column int64(const std::string& name) { return { name, 64, true }; }
+	static column uint64(const std::string& name) { return { name, 64, false }; }
+	static column int32(const std::string& name) { return { name, 32, true }; }
+	static column uint32(const std::string& name) { return { name, 32, false }; }
+	static column int8(const std::string& name) { return { name, 8, true }; }
+	static column uint8(const std::string& name) { return { name, 8, false }; }
+
+	columns(const std::string& path, const schema& fields, size_t batch = 65536)
+		: fields(fields), arrow(is_arrow(path)), batch(std::max<size_t>(batch, 1)), rows(0) {
+		out.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) throw std::runtime_error("cannot open " + path);
+		if (arrow) {
+			values.resize(fields.size());
+			for (auto& v : values) v.reserve(this->batch);
+			message(schema_message(), {});
+		} else {
+			for (size_t i = 0; i < fields.size(); i++)
+				out << (i ? "," : "") << fields[i].name << ":" << (fields[i].is_signed ? "int" : "uint") << fields[i].bits;
+			out << '\n';
+		}
+	}
+	columns(const columns&) = delete;
+	columns& operator =(const columns&) = delete;
+	~columns() { close(); }
+
+	/**
+	 * append a row, one value per column in the order of the schema
+	 */
+	void row(std::initializer_list<int64_t> row) {
+		if (row.size() != fields.size()) throw std::invalid_argument("the row does not match the schema");
+		if (!out.is_open()) return;
+		if (arrow) {
+			size_t i = 0;
+			for (int64_t v : row) values[i++].push_back(v);
+			if (values[0].size() == batch) flush();
+		} else {
+			size_t i = 0;
+			for (int64_t v : row) {
+				if (i) out << ',';
+				if (fields[i++].is_signed) out << v;
+				else out << uint64_t(v);
+			}
+			out << '\n';
+		}
+		rows++;
+	}
+
+	size_t size() const { return rows; }
+
+	void close() {
+		if (!out.is_open()) return;
+		if (arrow) {
+			flush();
+			const uint32_t eos[2] = { 0xffffffffu, 0 };
+			out.write(reinterpret_cast<const char*>(eos), sizeof(eos));
+		}
+		out.close();
+	}
+
+private:
+	static bool is_arrow(const std::string& path) {
+		for (std::string ext : { ".arrow", ".arrows" })
+			if (path.size() >= ext.size() && path.compare(path.size() - ext.size(), ext.size(), ext) == 0) return true;
+		return false;
+	}
+
+	/**
+	 * a minimal FlatBuffers encoder for the Arrow metadata
+	 * objects are laid out front to back, each table followed by the objects it refers to,
+	 * so that every reference (an unsigned 32-bit offset) points forward as the format requires
+	 */
+	struct flat {
+		struct object;
+		typedef std::shared_ptr<object> ref;
+		struct slot {
+			unsigned id, size;
+			uint64_t value;
+			ref child;
+		};
+		struct object {
+			enum { table, vector, structs, string } kind;
+			std::vector<slot> slots; // fields of a table, or offsets to the elements of a vector
+			std::string bytes; // the raw elements of a vector of structs, or a string
+			unsigned count;
+		};
+
+		static ref make_table() { ref t = std::make_shared<object>(); t->kind = object::table; return t; }
+		static void scalar(ref t, unsigned id, unsigned size, uint64_t value) { t->slots.push_back({ id, size, value, nullptr }); }
+		static void offset(ref t, unsigned id, ref child) { t->slots.push_back({ id, 4, 0, child }); }
+		static ref make_vector(const std::vector<ref>& items) {
+			ref v = std::make_shared<object>();
+			v->kind = object::vector;
+			for (const ref& item : items) v->slots.push_back({ 0, 4, 0, item });
+			v->count = items.size();
+			return v;
+		}
+		static ref make_structs(const std::vector<int64_t>& words, unsigned per) {
+			ref v = std::make_shared<object>();
+			v->kind = object::structs;
+			v->bytes.assign(reinterpret_cast<const char*>(words.data()), words.size() * sizeof(int64_t));
+			v->count = words.size() / per;
+			return v;
+		}
+		static ref make_string(const std::string& s) {
+			ref v = std::make_shared<object>();
+			v->kind = object::string;
+			v->bytes = s;
+			v->count = s.size();
+			return v;
+		}
+
+		/**
+		 * the buffer of a root table, padded to 8 bytes
+		 */
+		static std::string finish(ref root) {
+			std::string buf(4, '\0');
+			uint32_t at = write(buf, root);
+			put<uint32_t>(buf, 0, at);
+			pad(buf, 8);
+			return buf;
+		}
+
+	private:
+		template<typename type> static void put(std::string& buf, size_t at, type value) {
+			std::memcpy(&buf[at], &value, sizeof(type));
+		}
+		static void pad(std::string& buf, size_t align) {
+			buf.resize((buf.size() + align - 1) / align * align, '\0');
+		}
+		/**
+		 * write an object and its children, return its position
+		 */
+		static uint32_t write(std::string& buf, ref obj) {
+			std::vector<std::pair<size_t, ref>> refs; // the positions of the offsets to patch, and their targets
+			uint32_t at;
+			if (obj->kind == object::table) {
+				// fields: 4-byte ones right after the vtable offset, then 8, 2, and 1-byte ones
+				std::vector<unsigned> where(obj->slots.size());
+				unsigned size = 4, slots = 0;
+				for (unsigned width : { 4u, 8u, 2u, 1u }) {
+					for (size_t i = 0; i < obj->slots.size(); i++) {
+						if (obj->slots[i].size != width) continue;
+						size = (size + width - 1) / width * width;
+						where[i] = size;
+						size += width;
+					}
+				}
+				for (const slot& s : obj->slots) slots = std::max(slots, s.id + 1);
+				pad(buf, 2);
+				size_t vtable = buf.size();
+				buf.resize(vtable + 4 + 2 * slots, '\0');
+				put<uint16_t>(buf, vtable, 4 + 2 * slots);
+				put<uint16_t>(buf, vtable + 2, size);
+				for (size_t i = 0; i < obj->slots.size(); i++) put<uint16_t>(buf, vtable + 4 + 2 * obj->slots[i].id, where[i]);
+				pad(buf, 8);
+				at = buf.size();
+				buf.resize(at + size, '\0');
+				put<int32_t>(buf, at, int32_t(at - vtable));
+				for (size_t i = 0; i < obj->slots.size(); i++) {
+					const slot& s = obj->slots[i];
+					if (s.child) refs.emplace_back(at + where[i], s.child);
+					else std::memcpy(&buf[at + where[i]], &s.value, s.size); // little-endian
+				}
+			} else {
+				// the length precedes the elements, which are 8-byte aligned for structs
+				pad(buf, 4);
+				if (obj->kind == object::structs && (buf.size() + 4) % 8) buf.resize(buf.size() + 4, '\0');
+				at = buf.size();
+				buf.resize(at + 4, '\0');
+				put<uint32_t>(buf, at, obj->count);
+				if (obj->kind == object::vector) {
+					for (const slot& s : obj->slots) {
+						refs.emplace_back(buf.size(), s.child);
+						buf.resize(buf.size() + 4, '\0');
+					}
+				} else {
+					buf += obj->bytes;
+					if (obj->kind == object::string) buf += '\0';
+				}
+			}
+			for (auto& r : refs) {
+				uint32_t child = write(buf, r.second);
+				put<uint32_t>(buf, r.first, child - r.first);
+			}
+			return at;
+		}
+	};
+
+	enum { schema_header = 1, record_batch_header = 3, int_type = 2, metadata_v5 = 4 };
+
+	static std::string message_of(unsigned header_type, flat::ref header, int64_t body) {
+		flat::ref msg = flat::make_table();
+		flat::scalar(msg, 0, 2, metadata_v5);
+		flat::scalar(msg, 1, 1, header_type);
+		flat::offset(msg, 2, header);
+		flat::scalar(msg, 3, 8, body);
+		return flat::finish(msg);
+	}
+
+	std::string schema_message() const {
+		std::vector<flat::ref> list;
+		for (const column& c : fields) {
+			flat::ref type = flat::make_table();
+			flat::scalar(type, 0, 4, c.bits);
+			flat::scalar(type, 1, 1, c.is_signed);
+			flat::ref field = flat::make_table();
+			flat::offset(field, 0, flat::make_string(c.name));
+			flat::scalar(field, 1, 1, 0); // not nullable
+			flat::scalar(field, 2, 1, int_type);
+			flat::offset(field, 3, type);
+			flat::offset(field, 5, flat::make_vector({}));
+			list.push_back(field);
+		}
+		flat::ref schema = flat::make_table();
+		flat::offset(schema, 1, flat::make_vector(list));
+		return message_of(schema_header, schema, 0);
+	}
+
+	/**
+	 * write an encapsulated message: the continuation marker, the metadata length, the metadata, then the body
+	 */
+	void message(const std::string& meta, const std::string& body) {
+		const uint32_t head[2] = { 0xffffffffu, uint32_t(meta.size()) };
+		out.write(reinterpret_cast<const char*>(head), sizeof(head));
+		out << meta << body;
+	}
+
+	/**
+	 * write the rows of the current batch as a record batch, where each column is
+	 * an empty validity buffer and a data buffer padded to 8 bytes
+	 */
+	void flush() {
+		size_t length = values.empty() ? 0 : values[0].size();
+		if (length == 0) return;
+		std::string body;
+		std::vector<int64_t> nodes, buffers;
+		for (size_t i = 0; i < fields.size(); i++) {
+			size_t bytes = fields[i].bits / 8;
+			nodes.insert(nodes.end(), { int64_t(length), 0 });
+			buffers.insert(buffers.end(), { int64_t(body.size()), 0, int64_t(body.size()), int64_t(length * bytes) });
+			for (int64_t v : values[i]) body.append(reinterpret_cast<const char*>(&v), bytes); // little-endian
+			body.resize((body.size() + 7) / 8 * 8, '\0');
+			values[i].clear();
+		}
+		flat::ref batch = flat::make_table();
+		flat::scalar(batch, 0, 8, length);
+		flat::offset(batch, 1, flat::make_structs(nodes, 2));
+		flat::offset(batch, 2, flat::make_structs(buffers, 2));
+		message(message_of(record_batch_header, batch, body.size()), body);
+	}
+
+private:
+	schema fields;
+	bool arrow;
+	size_t batch;
+	size_t rows;
+	std::vector<std::vector<int64_t>> values;
+	std::ofstream out;
+};
@@ -96,6 +96,14 @@ public:
 		return res;
 	}
 
+	/**
+	 * call f(action, reward, time) for each move in order, e.g., to export the moves
+	 */
+	template<typename visitor>
+	void each_move(visitor f) const {
+		for (const move& mv : ep_moves) f(mv.code, mv.reward, mv.time);
+	}
+
 public:
 
 	friend std::ostream& operator <<(std::ostream& out, const episode& ep) {
@@ -0,0 +1,329 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * fuzz.cpp: Differential fuzzing of the board operations against a plain reference model
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include "board.h"
+
+/**
+ * the reference of the board operations, written for clarity only:
+ * 16 plain tile indices, and each direction slides its four lines directly, without rotations
+ */
+struct reference {
+	int cell[16];
+
+	reference(const board& b) { for (int i = 0; i < 16; i++) cell[i] = b(i); }
+
+	/**
+	 * the cells of line k of a slide, from the cell moved into first
+	 */
+	static int at(unsigned op, int k, int i) {
+		switch (op & 3) {
+		case 0: return i * 4 + k; // up
+		case 1: return k * 4 + 3 - i; // right
+		case 2: return (3 - i) * 4 + k; // down
+		default: return k * 4 + i; // left
+		}
+	}
+
+	static bool mergeable(int a, int b) { return std::abs(a - b) == 1 || (a == 1 && b == 1); }
+
+	board::reward slide(unsigned op) {
+		board::reward score = 0;
+		bool moved = false;
+		for (int k = 0; k < 4; k++) {
+			int line[4] = {}, n = 0;
+			for (int i = 0; i < 4; i++)
+				if (cell[at(op, k, i)]) line[n++] = cell[at(op, k, i)];
+			int out[4] = {}, m = 0;
+			for (int i = 0; i < n; i++) {
+				if (i + 1 < n && mergeable(line[i], line[i + 1])) {
+					out[m] = std::max(line[i], line[i + 1]) + 1;
+					score += board::fibb(out[m++]);
+					i++;
+				} else {
+					out[m++] = line[i];
+				}
+			}
+			for (int i = 0; i < 4; i++) {
+				moved |= (cell[at(op, k, i)] != out[i]);
+				cell[at(op, k, i)] = out[i];
+			}
+		}
+		return moved ? score : -1;
+	}
+
+	board::reward place(unsigned pos, int tile) {
+		if (pos >= 16 || (tile != 1 && tile != 2)) return -1;
+		cell[pos] = tile;
+		return 0;
+	}
+
+	unsigned space_left() const { return std::count(cell, cell + 16, 0); }
+
+	bool same(const board& b) const {
+		for (int i = 0; i < 16; i++)
+			if (int(b(i)) != cell[i]) return false;
+		return true;
+	}
+};
+
+/**
+ * compare every operation of the board against the reference, and
+ * return the names of the mismatching operations, or an empty string if all match
+ */
+static std::string differ(const board& b) {
+	std::string diff;
+	auto fail = [&](const std::string& what) { diff += (diff.size() ? ", " : "") + what; };
+	const char* name[] = { "slide_up", "slide_right", "slide_down", "slide_left" };
+
+	board after[4];
+	board::reward score[4];
+	board::slide_each(b, after, score);
+	for (unsigned op = 0; op < 4; op++) {
+		reference expect(b);
+		board::reward reward = expect.slide(op);
+		board s = b, d = b;
+		board::reward via_slide = s.slide(op), direct = 0;
+		switch (op) {
+		case 0: direct = d.slide_up(); break;
+		case 1: direct = d.slide_right(); break;
+		case 2: direct = d.slide_down(); break;
+		case 3: direct = d.slide_left(); break;
+		}
+		if (via_slide != reward || !expect.same(s) || s.info() != b.info()) fail("slide(" + std::to_string(op) + ")");
+		if (direct != reward || !expect.same(d)) fail(name[op]);
+		if (score[op] != reward || (reward != -1 && !expect.same(after[op])) || after[op].info() != b.info()) fail("slide_each[" + std::to_string(op) + "]");
+	}
+#if defined(BOARD8)
+	{
+		reference expect(b);
+		board::reward reward = expect.slide(3);
+		board s = b;
+		if (s.slide_left_scalar() != reward || !expect.same(s)) fail("slide_left_scalar");
+	}
+#endif
+
+	for (unsigned pos = 0; pos <= 16; pos++) {
+		for (int tile = 0; tile <= 3; tile++) {
+			reference expect(b);
+			board p = b;
+			if (p.place(pos, tile) != expect.place(pos, tile) || !expect.same(p)) {
+				fail("place(" + std::to_string(pos) + ", " + std::to_string(tile) + ")");
+				pos = 16;
+				break;
+			}
+		}
+	}
+
+	reference expect(b);
+	board s = b;
+	if (s.space_left() != expect.space_left()) fail("space_left");
+	unsigned mask = 0;
+	for (int i = 0; i < 16; i++) mask |= unsigned(expect.cell[i] == 0) << i;
+	if (b.empty_mask() != mask) fail("empty_mask");
+	if (!(b == board(b)) || b != board(b)) fail("operator==");
+	return diff;
+}
+
+/**
+ * shrink a failing board while it keeps failing: clear tiles, then lower them, until no step applies
+ * so that the result shows as few and as small tiles as possible
+ */
+static board minimize(board b) {
+	for (bool shrunk = true; shrunk; ) {
+		shrunk = false;
+		for (int i = 0; i < 16; i++) {
+			for (int to : { 0, 1, int(b(i)) / 2, int(b(i)) - 1 }) {
+				if (to < 0 || to >= int(b(i))) continue;
+				board t = b;
+				t(i) = to;
+				if (differ(t).size()) {
+					b = t;
+					shrunk = true;
+					break;
+				}
+			}
+		}
+	}
+	return b;
+}
+
+static void print(std::ostream& out, const board& b) {
+	for (int r = 0; r < 4; r++) {
+		out << "\t";
+		for (int c = 0; c < 4; c++) out << std::setw(3) << int(b[r][c]);
+		out << std::endl;
+	}
+}
+
+#if defined(LIBFUZZER)
+/**
+ * the libFuzzer entry point, each input of 16 bytes is a board of tiles (byte % board::tiles)
+ * build by clang++ -fsanitize=fuzzer -DLIBFUZZER, see makefile
+ */
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+	if (size != 16) return 0;
+	board b;
+	for (int i = 0; i < 16; i++) b(i) = data[i] % board::tiles;
+	std::string diff = differ(b);
+	if (diff.empty()) return 0;
+	std::cerr << "mismatch: " << diff << std::endl;
+	print(std::cerr, b);
+	board small = minimize(b);
+	std::cerr << "minimized: " << differ(small) << std::endl;
+	print(std::cerr, small);
+	__builtin_trap();
+}
+#else
+/**
+ * the k-th random board of a seed, with tiles below 'tiles'
+ * about half of the tiles repeat or continue the previous tile of the row, so that merges are frequent,
+ * and the fraction of empty cells varies from board to board
+ */
+static board random_board(uint64_t seed, uint64_t k, unsigned tiles) {
+	uint64_t h = board::mix(seed ^ board::mix(k));
+	unsigned empty = h % 17;
+	board b;
+	for (int i = 0; i < 16; i++) {
+		h = board::mix(h + i);
+		if (h % 16 < empty) continue;
+		int tile = 1 + (h >> 8) % (tiles - 1);
+		int prev = (i % 4) ? int(b(i - 1)) : 0;
+		if (prev && (h >> 32) % 2) tile = std::max(1, std::min(int(tiles) - 1, prev + int((h >> 40) % 3) - 1));
+		b(i) = tile;
+	}
+	return b;
+}
+
+/**
+ * the boards before each move of a game played by the reference with random moves and random tiles
+ */
+static void game_boards(uint64_t seed, uint64_t k, std::vector<board>& out) {
+	uint64_t h = board::mix(~seed ^ board::mix(k));
+	reference game{board()};
+	while (true) {
+		h = board::mix(h);
+		unsigned space = game.space_left();
+		if (space == 0) break;
+		unsigned nth = h % space;
+		for (int i = 0; i < 16; i++)
+			if (game.cell[i] == 0 && nth-- == 0) game.cell[i] = ((h >> 16) % 10) ? 1 : 2;
+		board b;
+		for (int i = 0; i < 16; i++) b(i) = game.cell[i];
+		out.push_back(b);
+		unsigned op = h >> 32;
+		bool moved = false;
+		for (unsigned t = 0; t < 4 && !moved; t++) {
+			reference next = game;
+			if (next.slide(op + t) != -1) game = next, moved = true;
+		}
+		if (!moved) break;
+	}
+}
+
+/**
+ * the standalone entry point
+ * ./2584-fuzz [boards=N] [threads=N] [tiles=N] [seed=N] [sample=R] [crash=PATH] [FILE]...
+ * checks the given boards of 16 bytes (as libFuzzer inputs), or else 'boards' boards split over the threads,
+ * where the fraction 'sample' of them are taken from random games, and the rest are random with tiles below 'tiles'
+ * the first mismatch stops all threads, and its minimized board is written to 'crash' in the same 16-byte format
+ */
+int main(int argc, const char* argv[]) {
+	std::map<std::string, std::string> opt = {
+		{ "boards", "10000000" },
+		{ "threads", std::to_string(std::max(std::thread::hardware_concurrency(), 1u)) },
+		{ "tiles", "32" },
+		{ "seed", "1" },
+		{ "sample", "0.5" },
+		{ "crash", "fuzz-crash.bin" },
+	};
+	std::vector<std::string> files;
+	for (int i = 1; i < argc; i++) {
+		std::string pair(argv[i]);
+		if (pair.find('=') == std::string::npos) files.push_back(pair);
+		else opt[pair.substr(0, pair.find('='))] = pair.substr(pair.find('=') + 1);
+	}
+	uint64_t total = std::stoull(opt["boards"]), seed = std::stoull(opt["seed"]);
+	size_t threads = std::max<size_t>(std::stoull(opt["threads"]), 1);
+	unsigned tiles = std::min<unsigned>(std::max<unsigned>(std::stoul(opt["tiles"]), 2), board::tiles);
+	double sample = std::stod(opt["sample"]);
+
+	std::mutex lock;
+	std::atomic<bool> failed(false);
+	std::atomic<uint64_t> checked(0);
+	board first;
+	auto check = [&](const board& b) {
+		if (differ(b).empty()) return true;
+		std::lock_guard<std::mutex> guard(lock);
+		if (!failed.exchange(true)) first = b;
+		return false;
+	};
+
+	auto start = std::chrono::steady_clock::now();
+	if (files.size()) {
+		for (const std::string& path : files) {
+			std::ifstream in(path, std::ios::in | std::ios::binary);
+			uint8_t data[16];
+			if (!in.read(reinterpret_cast<char*>(data), 16)) {
+				std::cerr << path << " is not a board of 16 bytes" << std::endl;
+				return 1;
+			}
+			board b;
+			for (int i = 0; i < 16; i++) b(i) = data[i] % board::tiles;
+			checked++;
+			if (!check(b)) break;
+		}
+	} else {
+		std::vector<std::thread> pool;
+		for (size_t t = 0; t < threads; t++) {
+			pool.emplace_back([&, t]() {
+				uint64_t share = total / threads + (t < total % threads);
+				uint64_t games = share * sample, k = 0, n = 0;
+				std::vector<board> boards;
+				for (uint64_t g = 0; n < games && !failed; g++) {
+					boards.clear();
+					game_boards(seed, g * threads + t, boards);
+					for (size_t i = 0; i < boards.size() && n < games; i++, n++)
+						if (!check(boards[i])) break;
+				}
+				for (; n < share && !failed; n++, k++)
+					if (!check(random_board(seed, k * threads + t, tiles))) break;
+				checked += n;
+			});
+		}
+		for (std::thread& t : pool) t.join();
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "fuzz: " << checked << " boards, " << threads << " threads, tiles below " << tiles << ", ";
+	std::cout << std::fixed << std::setprecision(0) << (checked / elapsed) << " boards/s" << std::endl;
+	if (!failed) return 0;
+
+	std::cout << "mismatch: " << differ(first) << std::endl;
+	print(std::cout, first);
+	board small = minimize(first);
+	std::cout << "minimized: " << differ(small) << std::endl;
+	print(std::cout, small);
+	std::ofstream out(opt["crash"], std::ios::out | std::ios::binary | std::ios::trunc);
+	for (int i = 0; i < 16; i++) out.put(char(small(i)));
+	std::cout << "written to " << opt["crash"] << std::endl;
+	return 1;
+}
+#endif
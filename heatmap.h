@@ -0,0 +1,145 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * heatmap.h: Access profiler of the weight tables, for layout and compression decisions
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <functional>
+#include <cstdint>
+#include "weight.h"
+
+/**
+ * read and write counts per cache line of each table, recorded in every 'period'-th episode
+ *
+ * the counters may be shared by the players of several threads, and are incremented atomically,
+ * the overhead is thus one branch per lookup in the episodes not sampled
+ */
+class heatmap {
+public:
+	static const size_t line = 64 / sizeof(weight::type);
+
+	heatmap(const std::vector<size_t>& lengths, unsigned period = 16) : period(std::max(period, 1u)), episodes(0), sampled(0) {
+		for (size_t length : lengths) {
+			reads.emplace_back((length + line - 1) / line);
+			writes.emplace_back((length + line - 1) / line);
+		}
+	}
+
+	/**
+	 * whether the next episode is recorded
+	 */
+	bool sample() {
+		bool take = (episodes++ % period == 0);
+		sampled += take;
+		return take;
+	}
+
+	void read(size_t table, size_t index) { __atomic_fetch_add(&reads[table][index / line], 1, __ATOMIC_RELAXED); }
+	void write(size_t table, size_t index) { __atomic_fetch_add(&writes[table][index / line], 1, __ATOMIC_RELAXED); }
+
+	/**
+	 * show the accesses and the working set of each table, i.e.,
+	 * the number of distinct lines covering 50/90/99% of the accesses, hottest first
+	 *
+	 * the format would be
+	 * heatmap: 17 tables, 64 of 1000 episodes sampled, 64 bytes per line
+	 *         [0]     reads = 2291204, writes = 0, lines = 5120/24415, 50% = 38, 90% = 420, 99% = 1706 (106KB)
+	 *         ...
+	 *         total   reads = 38951468, writes = 0, lines = 160133/415055, 50% = 1182, 90% = 10934, 99% = 37102 (2318KB)
+	 */
+	void report(std::ostream& out) const {
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << "heatmap: " << reads.size() << " tables, " << sampled << " of " << episodes << " episodes sampled, ";
+		out << (line * sizeof(weight::type)) << " bytes per line" << std::endl;
+		std::vector<uint64_t> all;
+		uint64_t r = 0, w = 0, n = 0;
+		for (size_t t = 0; t < reads.size(); t++) {
+			std::vector<uint64_t> heat = hotness(t);
+			uint64_t tr = 0, tw = 0;
+			for (size_t i = 0; i < reads[t].size(); i++) tr += reads[t][i], tw += writes[t][i];
+			out << "\t[" << t << "]\t";
+			summary(out, tr, tw, heat, reads[t].size());
+			r += tr, w += tw, n += reads[t].size();
+			all.insert(all.end(), heat.begin(), heat.end());
+		}
+		std::sort(all.begin(), all.end(), std::greater<uint64_t>());
+		out << "\ttotal\t";
+		summary(out, r, w, all, n);
+		out.copyfmt(ff);
+	}
+
+	/**
+	 * write the heat map as CSV, one row per accessed line: table,line,first,reads,writes
+	 * where 'first' is the first index of the line, and the working-set curves as rows of
+	 * curve,table,lines,coverage, where 'table' is -1 for the whole network
+	 */
+	bool save(const std::string& path) const {
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) return false;
+		out << "table,line,first,reads,writes" << std::endl;
+		for (size_t t = 0; t < reads.size(); t++)
+			for (size_t i = 0; i < reads[t].size(); i++)
+				if (reads[t][i] || writes[t][i])
+					out << t << "," << i << "," << (i * line) << "," << reads[t][i] << "," << writes[t][i] << std::endl;
+		std::vector<uint64_t> all;
+		for (size_t t = 0; t <= reads.size(); t++) {
+			std::vector<uint64_t> heat;
+			if (t < reads.size()) {
+				heat = hotness(t);
+				all.insert(all.end(), heat.begin(), heat.end());
+			} else {
+				heat.swap(all);
+				std::sort(heat.begin(), heat.end(), std::greater<uint64_t>());
+			}
+			uint64_t total = 0, sum = 0;
+			for (uint64_t h : heat) total += h;
+			for (size_t k = 0, step = std::max<size_t>(heat.size() / 100, 1); k < heat.size(); k++) {
+				sum += heat[k];
+				if ((k + 1) % step == 0 || k + 1 == heat.size())
+					out << "curve," << (t < reads.size() ? int(t) : -1) << "," << (k + 1) << "," << (sum * 1.0 / total) << std::endl;
+			}
+		}
+		return true;
+	}
+
+private:
+	/**
+	 * the accesses of the touched lines of a table, hottest first
+	 */
+	std::vector<uint64_t> hotness(size_t t) const {
+		std::vector<uint64_t> heat;
+		for (size_t i = 0; i < reads[t].size(); i++)
+			if (reads[t][i] || writes[t][i]) heat.push_back(uint64_t(reads[t][i]) + writes[t][i]);
+		std::sort(heat.begin(), heat.end(), std::greater<uint64_t>());
+		return heat;
+	}
+
+	static void summary(std::ostream& out, uint64_t r, uint64_t w, const std::vector<uint64_t>& heat, size_t lines) {
+		out << "reads = " << r << ", writes = " << w << ", lines = " << heat.size() << "/" << lines;
+		uint64_t total = r + w, sum = 0;
+		size_t k = 0, at99 = 0;
+		for (double p : { 0.5, 0.9, 0.99 }) {
+			for (; k < heat.size() && sum < p * total; k++) sum += heat[k];
+			out << ", " << int(p * 100) << "% = " << k;
+			at99 = k;
+		}
+		out << " (" << (at99 * line * sizeof(weight::type) / 1024) << "KB)" << std::endl;
+	}
+
+private:
+	std::vector<std::vector<uint32_t>> reads, writes;
+	unsigned period;
+	std::atomic<uint64_t> episodes;
+	std::atomic<uint64_t> sampled;
+};
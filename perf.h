@@ -0,0 +1,188 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * perf.h: Hardware performance counters for profiling the phases of a run
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * per-phase counters based on perf_event_open
+ *
+ * counters are disabled until open() succeeds, so that a scope costs only a branch
+ * hardware events are read as one group, software events as another
+ * events not supported by the host (e.g. inside a VM) are reported as "n/a"
+ */
+class perf {
+public:
+	enum phase { player, environment, update, statistics, phases };
+	enum event { cycles, instructions, l1d_miss, llc_miss, dtlb_miss, branch_miss, task_clock, page_faults, events };
+
+	/**
+	 * the counters of the calling thread
+	 */
+	static perf& counters() { static thread_local perf p; return p; }
+
+	/**
+	 * open the counters of the calling thread
+	 * return true if at least one event is available
+	 */
+	bool open() {
+		for (unsigned e = 0; e < events; e++) {
+			int& leader = (e < task_clock) ? hw_leader : sw_leader;
+			fd[e] = open_event(e, leader);
+			if (fd[e] == -1) continue;
+			if (leader == -1) leader = fd[e];
+			slot[e] = (e < task_clock) ? hw_size++ : sw_size++;
+		}
+		for (int leader : { hw_leader, sw_leader }) {
+			if (leader == -1) continue;
+			ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+		}
+		enabled = (hw_leader != -1 || sw_leader != -1);
+		return enabled;
+	}
+	bool active() const { return enabled; }
+	bool available(event e) const { return fd[e] != -1; }
+
+	void enter(phase p) {
+		if (!enabled) return;
+		sample(start[p]);
+	}
+	void leave(phase p) {
+		if (!enabled) return;
+		uint64_t now[events];
+		sample(now);
+		for (unsigned e = 0; e < events; e++) total[p][e] += now[e] - start[p][e];
+		calls[p]++;
+	}
+
+	/**
+	 * RAII helper for counting a phase
+	 */
+	class scope {
+	public:
+		scope(phase p) : p(p) { counters().enter(p); }
+		~scope() { counters().leave(p); }
+	private:
+		phase p;
+	};
+
+	/**
+	 * print the per-call averages of each phase since the last report, then reset
+	 *
+	 * the format would be
+	 *        player       cycles = 1850, IPC = 2.41, L1D = 3.12, LLC = 0.01, dTLB = 0.02, br = 4.75, usec = 0.62, faults = 0
+	 *
+	 * where the counters are averaged over the calls of the phase,
+	 * and 'usec' is the task clock (also available without a PMU)
+	 */
+	void report(std::ostream& out) {
+		if (!enabled) return;
+		const char* name[] = { "player", "environment", "update", "statistics" };
+		std::ios ff(nullptr);
+		ff.copyfmt(out);
+		out << std::fixed;
+		for (unsigned p = 0; p < phases; p++) {
+			if (calls[p] == 0) continue;
+			double n = calls[p];
+			out << "\t" << std::left << std::setw(12) << name[p] << std::right << " ";
+			out << std::setprecision(0);
+			out << "cycles = "; field(out, cycles, total[p][cycles] / n) << ", ";
+			out << std::setprecision(2);
+			out << "IPC = ";
+			if (available(cycles) && available(instructions) && total[p][cycles])
+				out << (total[p][instructions] * 1.0 / total[p][cycles]);
+			else
+				out << "n/a";
+			out << ", ";
+			out << "L1D = "; field(out, l1d_miss, total[p][l1d_miss] / n) << ", ";
+			out << "LLC = "; field(out, llc_miss, total[p][llc_miss] / n) << ", ";
+			out << "dTLB = "; field(out, dtlb_miss, total[p][dtlb_miss] / n) << ", ";
+			out << "br = "; field(out, branch_miss, total[p][branch_miss] / n) << ", ";
+			out << "usec = "; field(out, task_clock, total[p][task_clock] / n / 1000) << ", ";
+			out << std::setprecision(0);
+			out << "faults = "; field(out, page_faults, total[p][page_faults]);
+			out << std::endl;
+		}
+		out.copyfmt(ff);
+		std::memset(total, 0, sizeof(total));
+		std::memset(calls, 0, sizeof(calls));
+	}
+
+private:
+	perf() : hw_leader(-1), sw_leader(-1), hw_size(0), sw_size(0), enabled(false) {
+		std::fill(fd, fd + events, -1);
+		std::fill(slot, slot + events, 0);
+		std::memset(start, 0, sizeof(start));
+		std::memset(total, 0, sizeof(total));
+		std::memset(calls, 0, sizeof(calls));
+	}
+	~perf() {
+		for (int f : fd) if (f != -1) close(f);
+	}
+
+	static int open_event(unsigned e, int leader) {
+		perf_event_attr attr;
+		std::memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.disabled = (leader == -1);
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP;
+		auto cache = [](uint64_t id) {
+			return id | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		};
+		switch (e) {
+		case cycles:       attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_CPU_CYCLES; break;
+		case instructions: attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_INSTRUCTIONS; break;
+		case l1d_miss:     attr.type = PERF_TYPE_HW_CACHE; attr.config = cache(PERF_COUNT_HW_CACHE_L1D); break;
+		case llc_miss:     attr.type = PERF_TYPE_HW_CACHE; attr.config = cache(PERF_COUNT_HW_CACHE_LL); break;
+		case dtlb_miss:    attr.type = PERF_TYPE_HW_CACHE; attr.config = cache(PERF_COUNT_HW_CACHE_DTLB); break;
+		case branch_miss:  attr.type = PERF_TYPE_HARDWARE; attr.config = PERF_COUNT_HW_BRANCH_MISSES; break;
+		case task_clock:   attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_TASK_CLOCK; break;
+		case page_faults:  attr.type = PERF_TYPE_SOFTWARE; attr.config = PERF_COUNT_SW_PAGE_FAULTS; break;
+		default: return -1;
+		}
+		return syscall(SYS_perf_event_open, &attr, 0, -1, leader, 0);
+	}
+
+	void sample(uint64_t* value) {
+		uint64_t hw[events + 1] = { 0 }, sw[events + 1] = { 0 };
+		if (hw_leader != -1 && ::read(hw_leader, hw, sizeof(uint64_t) * (hw_size + 1)) <= 0) hw[0] = 0;
+		if (sw_leader != -1 && ::read(sw_leader, sw, sizeof(uint64_t) * (sw_size + 1)) <= 0) sw[0] = 0;
+		for (unsigned e = 0; e < events; e++) {
+			const uint64_t* group = (e < task_clock) ? hw : sw;
+			value[e] = (fd[e] != -1 && slot[e] < group[0]) ? group[slot[e] + 1] : 0;
+		}
+	}
+
+	std::ostream& field(std::ostream& out, event e, double v) const {
+		if (available(e)) return out << v;
+		return out << "n/a";
+	}
+
+private:
+	int fd[events];
+	unsigned slot[events];
+	int hw_leader, sw_leader;
+	unsigned hw_size, sw_size;
+	bool enabled;
+
+	uint64_t start[phases][events];
+	uint64_t total[phases][events];
+	uint64_t calls[phases];
+};
@@ -0,0 +1,261 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * remote.h: Distributed training with a parameter server over Unix domain sockets
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include "agent.h"
+#include "weight.h"
+
+/**
+ * blocking message channel over a Unix domain socket
+ *
+ * each message starts with a header of an opcode and a size,
+ * deltas: 'D', followed by 'size' records of (uint32 table, uint32 index, float value)
+ * pull:   'P', answered by the network (uint32 tables, then uint64 length and floats of each table)
+ */
+class channel {
+public:
+	struct header {
+		uint32_t op;
+		uint32_t reserved;
+		uint64_t size;
+	};
+
+public:
+	explicit channel(int fd = -1) : fd(fd) {}
+	channel(const channel&) = delete;
+	channel& operator =(const channel&) = delete;
+	~channel() { if (fd != -1) ::close(fd); }
+
+	int handle() const { return fd; }
+
+	static std::unique_ptr<channel> connect(const std::string& path) {
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr = address(path);
+		if (fd == -1 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+			if (fd != -1) ::close(fd);
+			throw std::runtime_error("cannot connect to " + path);
+		}
+		return std::unique_ptr<channel>(new channel(fd));
+	}
+
+	static std::unique_ptr<channel> listen(const std::string& path) {
+		int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un addr = address(path);
+		::unlink(path.c_str());
+		if (fd == -1 || ::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 || ::listen(fd, 64) == -1) {
+			if (fd != -1) ::close(fd);
+			throw std::runtime_error("cannot listen on " + path);
+		}
+		return std::unique_ptr<channel>(new channel(fd));
+	}
+
+	std::unique_ptr<channel> accept() {
+		int peer = ::accept(fd, nullptr, nullptr);
+		return std::unique_ptr<channel>(peer != -1 ? new channel(peer) : nullptr);
+	}
+
+	bool send(const void* data, size_t size) {
+		const char* ptr = static_cast<const char*>(data);
+		while (size) {
+			ssize_t n = ::send(fd, ptr, size, MSG_NOSIGNAL);
+			if (n <= 0) return false;
+			ptr += n, size -= n;
+		}
+		return true;
+	}
+	bool recv(void* data, size_t size) {
+		char* ptr = static_cast<char*>(data);
+		while (size) {
+			ssize_t n = ::recv(fd, ptr, size, 0);
+			if (n <= 0) return false;
+			ptr += n, size -= n;
+		}
+		return true;
+	}
+
+	/**
+	 * the tables are sent in chunks through the ranges of the weights, so that any layout (e.g., compact) is sent flat
+	 */
+	bool send_network(const player::network& net) {
+		uint32_t tables = net.size();
+		if (!send(&tables, sizeof(tables))) return false;
+		std::vector<weight::type> chunk;
+		for (const weight& w : net) {
+			uint64_t length = w.size();
+			if (!send(&length, sizeof(length))) return false;
+			for (size_t i = 0; i < length; i += chunk_size) {
+				chunk.resize(std::min<uint64_t>(chunk_size, length - i));
+				w.copy_to(i, chunk.size(), chunk.data());
+				if (!send(chunk.data(), sizeof(weight::type) * chunk.size())) return false;
+			}
+		}
+		return true;
+	}
+	bool recv_network(player::network& net) {
+		uint32_t tables = 0;
+		if (!recv(&tables, sizeof(tables))) return false;
+		net.resize(tables);
+		std::vector<weight::type> chunk;
+		for (weight& w : net) {
+			uint64_t length = 0;
+			if (!recv(&length, sizeof(length))) return false;
+			if (w.size() != length) w = weight(length);
+			for (size_t i = 0; i < length; i += chunk_size) {
+				chunk.resize(std::min<uint64_t>(chunk_size, length - i));
+				if (!recv(chunk.data(), sizeof(weight::type) * chunk.size())) return false;
+				w.copy_from(i, chunk.size(), chunk.data());
+			}
+		}
+		return true;
+	}
+
+private:
+	static sockaddr_un address(const std::string& path) {
+		sockaddr_un addr;
+		std::memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		std::strncpy(addr.sun_path, path.c_str(), sizeof(addr.sun_path) - 1);
+		return addr;
+	}
+
+	static const size_t chunk_size = 1 << 16;
+	int fd;
+};
+
+/**
+ * parameter server, which owns the network and serves workers until all of them disconnect
+ * deltas are applied in arrival order by a single thread, so that no update is lost
+ */
+class parameter_server {
+public:
+	parameter_server(const std::string& path, std::shared_ptr<player::network> net)
+		: path(path), net(net), pushes(0), records(0), pulls(0) {
+		if (!net) throw std::invalid_argument("the parameter server needs a network, use init or load");
+	}
+
+	void run() {
+		std::unique_ptr<channel> server = channel::listen(path);
+		std::vector<std::unique_ptr<channel>> peers;
+		size_t served = 0;
+		std::cout << "server: listening on " << path << std::endl;
+		while (peers.size() || served == 0) {
+			std::vector<pollfd> fds(1, pollfd{ server->handle(), POLLIN, 0 });
+			for (auto& peer : peers) fds.push_back(pollfd{ peer->handle(), POLLIN, 0 });
+			if (::poll(fds.data(), fds.size(), -1) == -1) break;
+			for (size_t i = peers.size(); i > 0; i--) {
+				if (!fds[i].revents) continue;
+				if (!handle(*peers[i - 1])) peers.erase(peers.begin() + (i - 1));
+			}
+			if (fds[0].revents & POLLIN) {
+				std::unique_ptr<channel> peer = server->accept();
+				if (peer) peers.push_back(std::move(peer)), served++;
+			}
+		}
+		::unlink(path.c_str());
+		std::cout << "server: " << served << " workers, " << pushes << " pushes (" << records << " deltas), " << pulls << " pulls" << std::endl;
+	}
+
+private:
+	bool handle(channel& peer) {
+		channel::header head;
+		if (!peer.recv(&head, sizeof(head))) return false;
+		if (head.op == 'D') {
+			buffer.resize(head.size * 3);
+			if (!peer.recv(buffer.data(), sizeof(uint32_t) * buffer.size())) return false;
+			for (size_t i = 0; i < buffer.size(); i += 3) {
+				uint32_t table = buffer[i], index = buffer[i + 1];
+				float value;
+				std::memcpy(&value, &buffer[i + 2], sizeof(value));
+				if (table < net->size() && index < (*net)[table].size()) (*net)[table].update(index, value);
+			}
+			pushes++;
+			records += head.size;
+			return true;
+		} else if (head.op == 'P') {
+			pulls++;
+			return peer.send_network(*net);
+		}
+		return false;
+	}
+
+private:
+	std::string path;
+	std::shared_ptr<player::network> net;
+	std::vector<uint32_t> buffer;
+	uint64_t pushes, records, pulls;
+};
+
+/**
+ * self-play worker of distributed training
+ * the adjustments are buffered (update=delta), applied locally and pushed to the server every 'flush' episodes,
+ * and the whole network is pulled from the server at start and every 'pull' episodes
+ *
+ * server=PATH: the socket of the parameter server
+ * pull=N: the period of pulling (100 by default)
+ */
+class worker : public player {
+public:
+	worker(const std::string& args = "") : player("init " + args + " update=delta"), pull(100), count(0) {
+		link = channel::connect(property("server"));
+		if (meta.find("pull") != meta.end())
+			pull = std::max(int(meta["pull"]), 1);
+		fetch();
+	}
+	virtual ~worker() {
+		try {
+			merge_deltas(); // the last deltas, which are lost if the server has gone
+		} catch (std::exception& e) {
+			std::cerr << e.what() << std::endl;
+		}
+	}
+
+	virtual void close_episode(const std::string& flag = "") {
+		player::close_episode(flag);
+		if (++count % pull == 0) fetch();
+	}
+
+protected:
+	virtual void merge_deltas() {
+		static_assert(sizeof(delta) == 3 * sizeof(uint32_t), "deltas are sent as raw records");
+		if (deltas.empty()) return;
+		coalesce_deltas();
+		auto net = weights();
+		for (const delta& d : deltas)
+			(*net)[d.table].update(d.index, d.value);
+		invalidate();
+		channel::header head = { 'D', 0, deltas.size() };
+		if (!link->send(&head, sizeof(head)) || !link->send(deltas.data(), sizeof(delta) * deltas.size()))
+			throw std::runtime_error("lost connection to the parameter server");
+		deltas.clear();
+	}
+
+	void fetch() {
+		channel::header head = { 'P', 0, 0 };
+		if (!link->send(&head, sizeof(head)) || !link->recv_network(*weights()))
+			throw std::runtime_error("lost connection to the parameter server");
+		invalidate();
+	}
+
+private:
+	std::unique_ptr<channel> link;
+	unsigned pull;
+	size_t count;
+};
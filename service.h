@@ -0,0 +1,268 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * service.h: Evaluation service of the network for external tools over a Unix domain socket
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdint>
+#include <poll.h>
+#include <unistd.h>
+#include "board.h"
+#include "agent.h"
+#include "remote.h"
+
+/**
+ * the service loads the network once and answers batches of boards, see channel for the header
+ * the size of a request is the number of boards, and each board is 16 bytes, the tile indices of cells (0) to (15)
+ *
+ * value: 'V', answered by 'V' and a float per board, the value of the board as an afterstate
+ * move:  'M', answered by 'M' and an (int32 opcode, float value) per board, the move of the player (name=TD,
+ *        expectimax, ...) and its reward plus the value of its afterstate, or (-1, 0) if no move is legal
+ * stats: 'S' of size 0, answered by 'S' and 'size' bytes of text, the metrics so far
+ *
+ * the requests of a connection are answered in order, one at a time
+ * each board of a move request is taken as a new episode, so that the opening book (book=PATH) applies to all alike
+ * a pool of workers, each with its own copy of the player, takes the pending requests of all connections
+ * together, up to 'batch' boards, and looks up the values of a batch table by table (see player::evaluate)
+ */
+class evaluation_server {
+public:
+	static const size_t board_bytes = 16;
+	static const uint64_t max_boards = 1 << 24;
+
+	evaluation_server(const std::string& path, const player& owner, size_t threads = 1, size_t batch = 4096, bool keep = false)
+		: path(path), owner(owner), threads(std::max<size_t>(threads, 1)), batch(std::max<size_t>(batch, 1)), keep(keep),
+		  stopping(false), received(0), requests(0), boards(0), batches(0), latency_sum(0), latency_max(0), histogram() {
+		if (!owner.weights()) throw std::invalid_argument("the evaluation service needs a network, use load");
+	}
+
+	/**
+	 * serve until all clients have disconnected, then print the metrics
+	 * or, if 'keep', serve until the process is terminated, e.g., for external tools running one after another
+	 */
+	void run() {
+		std::unique_ptr<channel> server = channel::listen(path);
+		if (::pipe(wake) == -1) throw std::runtime_error("cannot create a pipe");
+		std::vector<std::thread> pool;
+		for (size_t t = 0; t < threads; t++) pool.emplace_back([this]() { work(); });
+		std::cout << "service: listening on " << path << ", " << threads << " workers, batch = " << batch << std::endl;
+
+		std::vector<std::unique_ptr<connection>> peers;
+		size_t served = 0;
+		while (keep || peers.size() || served == 0) {
+			std::vector<pollfd> fds = { pollfd{ server->handle(), POLLIN, 0 }, pollfd{ wake[0], POLLIN, 0 } };
+			std::vector<connection*> polled;
+			for (auto& peer : peers) {
+				if (peer->busy) continue; // its response is pending
+				fds.push_back(pollfd{ peer->link->handle(), POLLIN, 0 });
+				polled.push_back(peer.get());
+			}
+			if (::poll(fds.data(), fds.size(), -1) == -1) break;
+			if (fds[1].revents & POLLIN) {
+				char drain[64];
+				if (::read(wake[0], drain, sizeof(drain)) < 0) break;
+			}
+			for (size_t i = 0; i < polled.size(); i++) {
+				if (!fds[i + 2].revents || receive(*polled[i])) continue;
+				peers.erase(std::find_if(peers.begin(), peers.end(),
+						[&](const std::unique_ptr<connection>& p) { return p.get() == polled[i]; }));
+			}
+			if (fds[0].revents & POLLIN) {
+				std::unique_ptr<channel> link = server->accept();
+				if (link) peers.emplace_back(new connection(std::move(link))), served++;
+			}
+		}
+
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			stopping = true;
+		}
+		pending.notify_all();
+		for (std::thread& t : pool) t.join();
+		::close(wake[0]);
+		::close(wake[1]);
+		::unlink(path.c_str());
+		std::cout << "service: " << served << " clients, " << metrics() << std::endl;
+	}
+
+	/**
+	 * the metrics so far, in the format of
+	 * requests = 1000, boards = 4096000, batches = 500 (8192 boards per batch), 2500000 boards/s,
+	 * latency = 1500 us avg, 1024/2048/4096 us 50/90/99%, 5000 us max
+	 * where the throughput is since the first request, and the percentiles are the upper bounds of power-of-two buckets
+	 */
+	std::string metrics() const {
+		std::lock_guard<std::mutex> guard(stats);
+		double elapsed = requests ? std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() : 1;
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(0);
+		ss << "requests = " << requests << ", boards = " << boards << ", batches = " << batches;
+		ss << " (" << (batches ? boards * 1.0 / batches : 0) << " boards per batch), " << (boards / elapsed) << " boards/s, ";
+		ss << "latency = " << (requests ? latency_sum * 1.0 / requests : 0) << " us avg, ";
+		uint64_t seen = 0;
+		size_t k = 0;
+		for (double p : { 0.5, 0.9, 0.99 }) {
+			for (; k < 63 && seen + histogram[k] < p * requests; k++) seen += histogram[k];
+			ss << (p != 0.5 ? "/" : "") << (uint64_t(1) << k);
+		}
+		ss << " us 50/90/99%, " << latency_max << " us max";
+		return ss.str();
+	}
+
+private:
+	struct connection {
+		std::unique_ptr<channel> link;
+		std::atomic<bool> busy;
+		connection(std::unique_ptr<channel> link) : link(std::move(link)), busy(false) {}
+	};
+
+	struct job {
+		connection* peer;
+		uint32_t op;
+		std::vector<board> boards;
+		std::chrono::steady_clock::time_point since;
+	};
+
+	/**
+	 * read a request of a connection and queue it, return false if the connection is to be closed
+	 */
+	bool receive(connection& peer) {
+		channel::header head;
+		if (!peer.link->recv(&head, sizeof(head))) return false;
+		if (head.op == 'S') {
+			std::string text = metrics();
+			channel::header reply = { 'S', 0, text.size() };
+			return peer.link->send(&reply, sizeof(reply)) && peer.link->send(text.data(), text.size());
+		}
+		if ((head.op != 'V' && head.op != 'M') || head.size > max_boards) return false;
+		std::vector<uint8_t> bytes(head.size * board_bytes);
+		if (!peer.link->recv(bytes.data(), bytes.size())) return false;
+		job req = { &peer, head.op, std::vector<board>(head.size), std::chrono::steady_clock::now() };
+		{
+			std::lock_guard<std::mutex> guard(stats);
+			if (!received++) start = req.since;
+		}
+		for (size_t i = 0; i < req.boards.size(); i++)
+			for (size_t c = 0; c < board_bytes; c++) req.boards[i](c) = std::min<unsigned>(bytes[i * board_bytes + c], board::tiles - 1);
+		peer.busy = true;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			queue.push_back(std::move(req));
+		}
+		pending.notify_one();
+		return true;
+	}
+
+	/**
+	 * take the pending requests up to 'batch' boards (at least one request), then answer them
+	 */
+	void work() {
+		player play(owner);
+		agent& mover = play;
+		std::vector<board> afters;
+		std::vector<float> values;
+		for (std::vector<job> jobs; ; jobs.clear()) {
+			{
+				std::unique_lock<std::mutex> guard(lock);
+				pending.wait(guard, [this]() { return stopping || queue.size(); });
+				if (queue.empty()) return;
+				size_t taken = 0;
+				while (queue.size() && (jobs.empty() || taken + queue.front().boards.size() <= batch)) {
+					taken += queue.front().boards.size();
+					jobs.push_back(std::move(queue.front()));
+					queue.pop_front();
+				}
+			}
+
+			// the values of all boards of the value requests in one batch
+			afters.clear();
+			for (const job& req : jobs)
+				if (req.op == 'V') afters.insert(afters.end(), req.boards.begin(), req.boards.end());
+			values.resize(afters.size());
+			play.evaluate(afters.data(), values.data(), afters.size());
+
+			size_t offset = 0;
+			for (job& req : jobs) {
+				channel::header reply = { req.op, 0, req.boards.size() };
+				bool sent;
+				if (req.op == 'V') {
+					sent = req.peer->link->send(&reply, sizeof(reply)) &&
+						   req.peer->link->send(&values[offset], sizeof(float) * req.boards.size());
+					offset += req.boards.size();
+				} else {
+					std::vector<std::pair<int32_t, float>> moves(req.boards.size());
+					for (size_t i = 0; i < req.boards.size(); i++) {
+						play.open_episode(); // drops the history of the moves and restarts the book
+						action move = mover.take_action(req.boards[i]);
+						if (move.type() != action::slide::type) {
+							moves[i] = { -1, 0.0f };
+							continue;
+						}
+						board after = req.boards[i];
+						board::reward reward = after.slide(move.event());
+						moves[i] = { int32_t(move.event() & 3), float(reward + play.evaluate(after)) };
+					}
+					static_assert(sizeof(moves[0]) == 8, "moves are sent as raw (int32, float) pairs");
+					sent = req.peer->link->send(&reply, sizeof(reply)) &&
+						   req.peer->link->send(moves.data(), sizeof(moves[0]) * moves.size());
+				}
+				record(req);
+				if (!sent) ::shutdown(req.peer->link->handle(), SHUT_RDWR); // closed by the poll loop
+				req.peer->busy = false;
+			}
+			{
+				std::lock_guard<std::mutex> guard(stats);
+				batches++;
+			}
+			if (::write(wake[1], "w", 1) < 0) return;
+		}
+	}
+
+	void record(const job& req) {
+		auto us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - req.since).count();
+		std::lock_guard<std::mutex> guard(stats);
+		requests++;
+		boards += req.boards.size();
+		latency_sum += us;
+		latency_max = std::max<uint64_t>(latency_max, us);
+		size_t k = 0;
+		while (k < 63 && (uint64_t(1) << k) < uint64_t(us)) k++;
+		histogram[k]++;
+	}
+
+private:
+	std::string path;
+	const player& owner;
+	size_t threads;
+	size_t batch;
+	bool keep;
+	int wake[2];
+
+	std::mutex lock;
+	std::condition_variable pending;
+	std::deque<job> queue;
+	bool stopping;
+
+	mutable std::mutex stats;
+	std::chrono::steady_clock::time_point start;
+	uint64_t received, requests, boards, batches;
+	uint64_t latency_sum, latency_max;
+	uint64_t histogram[64];
+};
@@ -0,0 +1,190 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * shm.h: Shared-memory weight store for multiple evaluator processes
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <thread>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "weight.h"
+
+/**
+ * a network published in a POSIX shared memory object, e.g., /dev/shm/NAME
+ *
+ * the object holds two slots of all tables, an atomic generation counter, and the number of readers of each slot
+ * a publisher writes the inactive slot, then increments the generation to switch the slots,
+ * so that attached readers pick up new versions between episodes without restarting
+ * a reader holds its slot as long as it uses the network of view(), and the publisher does not write a held slot,
+ * so that a reader still on the old slot never observes a partial write
+ *
+ * the object stays in memory after the publisher exits, until it is removed by unlink()
+ */
+class shared_weights : public std::enable_shared_from_this<shared_weights> {
+public:
+	typedef std::vector<weight> network;
+
+	/**
+	 * create (or reuse, if the shape matches) the object for publishing the given network
+	 */
+	static std::shared_ptr<shared_weights> create(const std::string& name, const network& net) {
+		if (net.size() > max_tables) throw std::invalid_argument("too many tables for shared memory");
+		uint64_t floats = 0;
+		for (const weight& w : net) floats += w.size();
+		size_t size = offset() + 2 * floats * sizeof(weight::type);
+		int fd = ::shm_open(path(name).c_str(), O_CREAT | O_RDWR, 0644);
+		if (fd == -1 || ::ftruncate(fd, size) == -1) {
+			if (fd != -1) ::close(fd);
+			throw std::runtime_error("cannot create shared memory " + name);
+		}
+		std::shared_ptr<shared_weights> store(new shared_weights(fd, size, true));
+		layout& head = store->header();
+		bool reuse = std::memcmp(head.magic, magic(), sizeof(head.magic)) == 0 && head.tables == net.size();
+		for (size_t i = 0; reuse && i < net.size(); i++) reuse = (head.lengths[i] == net[i].size());
+		if (!reuse) {
+			head.tables = net.size();
+			head.floats = floats;
+			for (size_t i = 0; i < net.size(); i++) head.lengths[i] = net[i].size();
+			head.generation.store(0);
+			head.readers[0].store(0);
+			head.readers[1].store(0);
+			std::memcpy(head.magic, magic(), sizeof(head.magic));
+		}
+		return store;
+	}
+
+	/**
+	 * attach to a published network for reading, where the object is writable only for the reader counts
+	 */
+	static std::shared_ptr<shared_weights> attach(const std::string& name) {
+		int fd = ::shm_open(path(name).c_str(), O_RDWR, 0);
+		struct stat info;
+		if (fd == -1 || ::fstat(fd, &info) == -1 || size_t(info.st_size) < offset()) {
+			if (fd != -1) ::close(fd);
+			throw std::runtime_error("cannot attach shared memory " + name);
+		}
+		std::shared_ptr<shared_weights> store(new shared_weights(fd, info.st_size, true));
+		const layout& head = store->header();
+		if (std::memcmp(head.magic, magic(), sizeof(head.magic)) != 0 || head.tables > max_tables)
+			throw std::runtime_error(name + " is not a published network");
+		uint64_t floats = 0;
+		for (uint32_t i = 0; i < head.tables; i++) floats += head.lengths[i];
+		if (floats != head.floats || store->size < offset() + 2 * floats * sizeof(weight::type))
+			throw std::runtime_error(name + " is truncated");
+		return store;
+	}
+
+	static bool unlink(const std::string& name) {
+		return ::shm_unlink(path(name).c_str()) == 0;
+	}
+
+	~shared_weights() {
+		::munmap(base, size);
+	}
+
+public:
+	uint64_t generation() const {
+		return header().generation.load(std::memory_order_acquire);
+	}
+
+	/**
+	 * copy the network into the inactive slot, then make it current, which is false if the slot is still held by readers
+	 * the readers are waited for up to 'patience' seconds, after which the slot is written anyway with a warning,
+	 * since its readers have likely been killed without releasing it; a patience of 0 does not wait nor write
+	 */
+	bool publish(const network& net, double patience = 10) {
+		uint64_t next = generation() + 1;
+		const std::atomic<uint32_t>& readers = header().readers[next & 1];
+		auto since = std::chrono::steady_clock::now();
+		while (readers.load() != 0) {
+			if (patience <= 0) return false;
+			if (std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count() > patience) {
+				std::cerr << "shm: publishing over " << readers.load() << " readers that have not released the slot" << std::endl;
+				break;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		weight::type* data = slot(next);
+		for (const weight& w : net) {
+			std::copy(&w[0], &w[0] + w.size(), data);
+			data += w.size();
+		}
+		header().generation.store(next);
+		return true;
+	}
+
+	/**
+	 * the network of the current slot, as views into the shared memory, which holds the slot until it is released
+	 * a reader counts itself on the slot, then checks that the slot is still current, since otherwise
+	 * the publisher may have missed the count and be writing the slot
+	 */
+	std::shared_ptr<network> view() {
+		layout& head = header();
+		uint64_t gen;
+		while (true) {
+			gen = generation();
+			head.readers[gen & 1].fetch_add(1);
+			if (head.generation.load() == gen) break; // sequentially consistent with the count, see publish
+			head.readers[gen & 1].fetch_sub(1);
+		}
+		std::shared_ptr<shared_weights> self = shared_from_this();
+		std::shared_ptr<network> net(new network(), [self, gen](network* n) {
+			delete n;
+			self->header().readers[gen & 1].fetch_sub(1);
+		});
+		weight::type* data = slot(gen);
+		for (uint32_t i = 0; i < head.tables; i++) {
+			net->emplace_back(data, head.lengths[i]);
+			data += head.lengths[i];
+		}
+		return net;
+	}
+
+private:
+	static const size_t max_tables = 64;
+	struct layout {
+		char magic[8];
+		uint32_t tables;
+		uint32_t reserved;
+		uint64_t floats;
+		std::atomic<uint64_t> generation;
+		std::atomic<uint32_t> readers[2];
+		uint64_t lengths[max_tables];
+	};
+
+	shared_weights(int fd, size_t size, bool writable) : size(size) {
+		int prot = writable ? (PROT_READ | PROT_WRITE) : PROT_READ;
+		base = static_cast<char*>(::mmap(nullptr, size, prot, MAP_SHARED, fd, 0));
+		::close(fd);
+		if (base == MAP_FAILED) throw std::runtime_error("cannot map shared memory");
+	}
+
+	static const char* magic() { return "2584sh2"; }
+	static std::string path(const std::string& name) { return name[0] == '/' ? name : "/" + name; }
+	static size_t offset() { return (sizeof(layout) + 4095) & ~size_t(4095); }
+
+	layout& header() const { return *reinterpret_cast<layout*>(base); }
+	weight::type* slot(uint64_t gen) const {
+		return reinterpret_cast<weight::type*>(base + offset()) + (gen & 1) * header().floats;
+	}
+
+private:
+	char* base;
+	size_t size;
+};
@@ -8,29 +8,152 @@
  */
 
 #pragma once
-#include <list>
+#include <deque>
+#include <functional>
+#include <vector>
 #include <algorithm>
 #include <iostream>
 #include <sstream>
+#include <iomanip>
+#include <string>
+#include <stdexcept>
+#include <cmath>
 #include "board.h"
 #include "action.h"
 #include "agent.h"
 #include "episode.h"
+#include "perf.h"
+#include "trace.h"
+
+/**
+ * sequential stopping rules for evaluation runs, updated at every closed episode
+ *
+ * rule=ci: confidence interval of the average score
+ *   width=W: stop when the half-width is below W times the average (e.g., 0.01 for +-1%)
+ *   score=S: stop when the interval excludes S, i.e., the average is decided above or below S
+ *   z=Z: the z-score of the interval (1.96 by default)
+ * rule=sprt: sequential probability ratio test of the win rate at a tile
+ *   tile=T: the target tile (2584 by default)
+ *   p0=P0 p1=P1: the win rates of H0 and H1, where P0 < P1
+ *   alpha=A beta=B: the error rates (0.05 by default)
+ * min=N: the minimum episodes before any decision (30 by default)
+ */
+class stopping {
+public:
+	stopping(const std::string& args = "") : rule(args.size() ? "ci" : ""), width(0), score(0), has_score(false), z(1.96),
+		tile(0), p0(0.5), p1(0.6), alpha(0.05), beta(0.05), least(30), n(0), mean(0), m2(0), llr(0) {
+		unsigned target = 2584;
+		std::stringstream ss(args);
+		for (std::string pair; ss >> pair; ) {
+			std::string key = pair.substr(0, pair.find('='));
+			std::string value = pair.substr(pair.find('=') + 1);
+			if (key == "rule") rule = value;
+			else if (key == "width") width = std::stod(value);
+			else if (key == "score") score = std::stod(value), has_score = true;
+			else if (key == "z") z = std::stod(value);
+			else if (key == "tile") target = std::stoul(value);
+			else if (key == "p0") p0 = std::stod(value);
+			else if (key == "p1") p1 = std::stod(value);
+			else if (key == "alpha") alpha = std::stod(value);
+			else if (key == "beta") beta = std::stod(value);
+			else if (key == "min") least = std::stoull(value);
+		}
+		while (board::fibb(tile + 1) < target && tile < 63) tile++;
+		if (rule.size() && rule != "ci" && rule != "sprt")
+			throw std::invalid_argument(rule + " is not a valid stopping rule");
+	}
+
+public:
+	bool enabled() const { return rule.size(); }
+
+	/**
+	 * add the result of an episode
+	 * return true if the run is statistically decided
+	 */
+	bool update(board::reward result, unsigned max_tile) {
+		n++;
+		double delta = result - mean;
+		mean += delta / n;
+		m2 += delta * (result - mean);
+		llr += (max_tile >= tile) ? std::log(p1 / p0) : std::log((1 - p1) / (1 - p0));
+		return decided();
+	}
+
+	bool decided() const {
+		if (!enabled() || n < least) return false;
+		if (rule == "sprt") return llr >= std::log((1 - beta) / alpha) || llr <= std::log(beta / (1 - alpha));
+		double half = half_width();
+		if (has_score && (mean - half > score || mean + half < score)) return true;
+		return width > 0 && half <= width * std::abs(mean);
+	}
+
+	std::string verdict() const {
+		std::stringstream ss;
+		ss << std::fixed << std::setprecision(0);
+		ss << "stop after " << n << " episodes: ";
+		if (rule == "sprt") {
+			ss << std::setprecision(2);
+			ss << "win rate of " << board::fibb(tile + 1) << " is " << (llr > 0 ? ">= " : "<= ") << (llr > 0 ? p1 : p0);
+			ss << " (llr = " << llr << ")";
+		} else {
+			ss << "avg = " << mean << " +- " << half_width();
+			if (has_score) ss << ((mean > score) ? " > " : " < ") << score;
+		}
+		return ss.str();
+	}
+
+private:
+	double half_width() const {
+		return n > 1 ? z * std::sqrt(m2 / (n - 1) / n) : 0;
+	}
+
+private:
+	std::string rule;
+	double width, score;
+	bool has_score;
+	double z;
+	unsigned tile;
+	double p0, p1, alpha, beta;
+	size_t least;
+
+	size_t n;
+	double mean, m2;
+	double llr;
+};
+
+/**
+ * the summary of an episode, which is all that statistic::show needs
+ */
+struct record {
+	board::reward score;
+	uint32_t slides, places; // the steps of the player and of the environment
+	uint32_t time, slide_time, place_time; // in milliseconds
+	uint8_t tile; // the largest tile
+
+	record(const episode& ep) : score(ep.score()),
+		slides(ep.step(action::slide::type)), places(ep.step(action::place::type)),
+		time(ep.time()), slide_time(ep.time(action::slide::type)), place_time(ep.time(action::place::type)),
+		tile(*std::max_element(&(ep.state()(0)), &(ep.state()(16)))) {}
+};
+static_assert(sizeof(record) == 32, "record should fit in 32 bytes");
 
 class statistic {
 public:
 	/**
 	 * the total episodes to run
 	 * the block size of statistic
-	 * the limit of saving records
+	 * the limit of saving records, i.e., the summaries of the last 'limit' episodes are kept
+	 *
+	 * the stopping rule of the run (see stopping), which may finish it before total
 	 *
 	 * note that total >= limit >= block
 	 */
-	statistic(size_t total, size_t block = 0, size_t limit = 0)
+	statistic(size_t total, size_t block = 0, size_t limit = 0, const std::string& stop = "")
 		: total(total),
 		  block(block ? block : total),
 		  limit(limit ? limit : total),
-		  count(0) {}
+		  count(0),
+		  rule(stop) {}
 
 public:
 	/**
@@ -54,25 +177,28 @@ public:
 	 *                                  the average speed of environment is 896715
 	 *  '93.7%': 93.7% (937 games) reached 8192-tiles (a.k.a. win rate of 8192-tile)
 	 *  '22.4%': 22.4% (224 games) terminated with 8192-tiles (the largest)
+	 *
+	 * if performance counters are enabled (--perf), the per-phase counters
+	 * of the block are printed right after the first line, see perf::report
 	 */
 	void show(bool tstat = true) const {
 		size_t blk = std::min(data.size(), block);
-		size_t stat[64] = { 0 };
+		size_t stat[board::tiles] = { 0 };
 		size_t sop = 0, pop = 0, eop = 0;
 		time_t sdu = 0, pdu = 0, edu = 0;
 		board::reward sum = 0, max = 0;
 		auto it = data.end();
 		for (size_t i = 0; i < blk; i++) {
-			auto& ep = *(--it);
-			sum += ep.score();
-			max = std::max(ep.score(), max);
-			stat[*std::max_element(&(ep.state()(0)), &(ep.state()(16)))]++;
-			sop += ep.step();
-			pop += ep.step(action::slide::type);
-			eop += ep.step(action::place::type);
-			sdu += ep.time();
-			pdu += ep.time(action::slide::type);
-			edu += ep.time(action::place::type);
+			const record& ep = *(--it);
+			sum += ep.score;
+			max = std::max(ep.score, max);
+			stat[std::min<unsigned>(ep.tile, board::tiles - 1)]++;
+			sop += ep.slides + ep.places;
+			pop += ep.slides;
+			eop += ep.places;
+			sdu += ep.time;
+			pdu += ep.slide_time;
+			edu += ep.place_time;
 		}
 
 		std::ios ff(nullptr);
@@ -86,6 +212,7 @@ public:
 		std::cout <<      "|" << (eop * 1000.0 / edu) << ")";
 		std::cout << std::endl;
 		std::cout.copyfmt(ff);
+		perf::counters().report(std::cout);
 
 		if (!tstat) return;
 		for (size_t t = 0, c = 0; c < blk; c += stat[t++]) {
@@ -107,50 +234,82 @@ public:
 	}
 
 	bool is_finished() const {
-		return count >= total;
+		return count >= total || rule.decided();
 	}
 
 	void open_episode(const std::string& flag = "") {
-		if (count++ >= limit) data.pop_front();
-		data.emplace_back();
-		data.back().open_episode(flag);
+		count++;
+		current = {};
+		current.open_episode(flag);
 	}
 
 	void close_episode(const std::string& flag = "") {
-		data.back().close_episode(flag);
-		if (count % block == 0) show();
+		current.close_episode(flag);
+		keep(current);
+		const record& ep = data.back();
+		bool decided = rule.enabled() && rule.update(ep.score, ep.tile);
+		if (count % block == 0 || decided) show();
+		if (decided) std::cout << rule.verdict() << std::endl;
 	}
 
-	episode& at(size_t i) {
-		auto it = data.begin();
-		while (i--) it++;
-		return *it;
+	/**
+	 * call 'sink' with every closed (or loaded) episode before it is reduced to its record,
+	 * e.g., to stream the full episodes to a file, since only the records are kept
+	 */
+	void observe(std::function<void(const episode&)> sink) {
+		sinks.push_back(sink);
 	}
-	episode& front() {
+
+	/**
+	 * take the records of another statistic of the same run, e.g., of another thread, for the summary
+	 */
+	void merge(const statistic& part) {
+		for (const record& ep : part.data) {
+			if (limit && data.size() >= limit) data.pop_front();
+			data.push_back(ep);
+		}
+		count += part.count;
+	}
+
+	const record& at(size_t i) const {
+		return data.at(i);
+	}
+	const record& front() const {
 		return data.front();
 	}
 	episode& back() {
-		return data.back();
+		return current;
 	}
 
-	friend std::ostream& operator <<(std::ostream& out, const statistic& stat) {
-		for (const episode& rec : stat.data) out << rec << std::endl;
-		return out;
-	}
+	/**
+	 * load the episodes saved by --save, one per line, as if they were closed in this run
+	 */
 	friend std::istream& operator >>(std::istream& in, statistic& stat) {
+		TRACE_SCOPE("statistic_load");
+		episode ep;
 		for (std::string line; std::getline(in, line) && line.size(); ) {
-			stat.data.emplace_back();
-			std::stringstream(line) >> stat.data.back();
+			std::stringstream(line) >> ep;
+			stat.keep(ep);
+			stat.count++;
 		}
-		stat.total = std::max(stat.total, stat.data.size());
-		stat.count = stat.data.size();
+		stat.total = std::max(stat.total, stat.count);
 		return in;
 	}
 
+private:
+	void keep(const episode& ep) {
+		for (auto& sink : sinks) sink(ep);
+		if (limit && data.size() >= limit) data.pop_front(); // no limit if total = 0, e.g., for --load only
+		data.emplace_back(ep);
+	}
+
 private:
 	size_t total;
 	size_t block;
 	size_t limit;
 	size_t count;
-	std::list<episode> data;
+	std::deque<record> data;
+	episode current;
+	std::vector<std::function<void(const episode&)>> sinks;
+	stopping rule;
 };
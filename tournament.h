@@ -0,0 +1,162 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * tournament.h: Paired evaluation of several networks on identical environments
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cmath>
+#include "board.h"
+#include "action.h"
+#include "agent.h"
+#include "episode.h"
+
+class tournament {
+public:
+	/**
+	 * the weight files to compare, separated by spaces or commas
+	 * the common arguments of players (e.g., name=expectimax depth=2), where alpha is forced to 0
+	 * the arguments of the environment, where 'seed' is the base seed of all episodes
+	 * the number of episodes, and the number of threads (0 for all cores)
+	 *
+	 * each network is loaded once, and is shared read-only by the players of all threads
+	 */
+	tournament(const std::string& nets, const std::string& play_args, const std::string& evil_args,
+			size_t total, size_t threads = 0)
+		: env(evil_args), seed(0), total(total),
+		  threads(threads ? threads : std::max(std::thread::hardware_concurrency(), 1u)) {
+		std::string list(nets);
+		std::replace(list.begin(), list.end(), ',', ' ');
+		std::stringstream ss(list);
+		for (std::string path; ss >> path; ) {
+			names.push_back(path);
+			entrants.emplace_back(new player(play_args + " load=" + path + " alpha=0"));
+			scores.emplace_back(total);
+		}
+		std::stringstream es(evil_args);
+		for (std::string pair; es >> pair; ) {
+			if (pair.find("seed=") == 0) seed = std::stoull(pair.substr(5));
+		}
+	}
+
+public:
+	/**
+	 * play 'total' episodes for every network, where the i-th episode of all networks
+	 * is played with the player and the environment seeded by the same episode seed
+	 */
+	void run() {
+		std::atomic<size_t> next(0);
+		auto worker = [&]() {
+			std::vector<player> plays;
+			for (auto& proto : entrants) plays.push_back(*proto);
+			rndenv evil(env);
+			for (size_t i; (i = next++) < total; ) {
+				unsigned ep_seed = board::mix(seed * 0x9e3779b97f4a7c15ull + i);
+				for (size_t k = 0; k < plays.size(); k++) {
+					plays[k].reseed(ep_seed);
+					evil.reseed(ep_seed);
+					scores[k][i] = play_episode(plays[k], evil);
+				}
+			}
+		};
+		std::vector<std::thread> pool;
+		for (size_t t = 1; t < threads; t++) pool.emplace_back(worker);
+		worker();
+		for (std::thread& t : pool) t.join();
+	}
+
+	/**
+	 * show the average score of each network, and the paired score differences
+	 *
+	 * the format would be
+	 * tournament: 3 networks, 1000 episodes, 8 threads
+	 *        [0]     avg = 169626, sd = 70321, max = 340914   a.bin
+	 *        [1]     avg = 171233, sd = 71150, max = 382324   b.bin
+	 *        [1]-[0] diff = 1607 +- 1834 (95% CI), t = 1.72
+	 *
+	 * where the difference is significant if the interval excludes 0
+	 */
+	void summary() const {
+		std::ios ff(nullptr);
+		ff.copyfmt(std::cout);
+		std::cout << std::fixed << std::setprecision(0);
+		std::cout << "tournament: " << names.size() << " networks, " << total << " episodes, " << threads << " threads" << std::endl;
+		size_t best = 0;
+		for (size_t k = 0; k < names.size(); k++) {
+			double mean, sd;
+			moments(scores[k], mean, sd);
+			board::reward max = total ? *std::max_element(scores[k].begin(), scores[k].end()) : 0;
+			std::cout << "\t[" << k << "]\tavg = " << mean << ", sd = " << sd << ", max = " << max;
+			std::cout << "\t" << names[k] << std::endl;
+			if (mean > average(best)) best = k;
+		}
+		for (size_t k = 0; k < names.size(); k++) {
+			for (size_t j = 0; j < k; j++) {
+				std::vector<double> diff(total);
+				for (size_t i = 0; i < total; i++) diff[i] = double(scores[k][i]) - scores[j][i];
+				double mean, sd;
+				moments(diff, mean, sd);
+				double se = sd / std::sqrt(std::max<double>(total, 1));
+				std::cout << "\t[" << k << "]-[" << j << "]\tdiff = " << mean << " +- " << (1.96 * se) << " (95% CI)";
+				std::cout << std::setprecision(2) << ", t = " << (se > 0 ? mean / se : 0) << std::setprecision(0);
+				std::cout << std::endl;
+			}
+		}
+		if (names.size()) std::cout << "best: [" << best << "] " << names[best] << std::endl;
+		std::cout.copyfmt(ff);
+	}
+
+private:
+	static board::reward play_episode(player& play, rndenv& evil) {
+		episode game;
+		game.open_episode(play.name() + ":" + evil.name());
+		play.open_episode("~:" + evil.name());
+		evil.open_episode(play.name() + ":~");
+		while (true) {
+			agent& who = game.take_turns(play, evil);
+			action move = who.take_action(game.state());
+			if (game.apply_action(move) != true) break;
+			if (who.check_for_win(game.state())) break;
+		}
+		agent& win = game.last_turns(play, evil);
+		game.close_episode(win.name());
+		play.close_episode(win.name());
+		evil.close_episode(win.name());
+		return game.score();
+	}
+
+	template<typename value>
+	static void moments(const std::vector<value>& data, double& mean, double& sd) {
+		double sum = 0, sq = 0;
+		for (value v : data) sum += v, sq += double(v) * v;
+		size_t n = data.size();
+		mean = n ? sum / n : 0;
+		sd = n > 1 ? std::sqrt(std::max(0.0, (sq - sum * mean) / (n - 1))) : 0;
+	}
+
+	double average(size_t k) const {
+		double mean, sd;
+		moments(scores[k], mean, sd);
+		return mean;
+	}
+
+private:
+	std::vector<std::string> names;
+	std::vector<std::unique_ptr<player>> entrants;
+	rndenv env;
+	uint64_t seed;
+	size_t total;
+	size_t threads;
+	std::vector<std::vector<board::reward>> scores;
+};
@@ -0,0 +1,172 @@
+/**
+ * Framework for 2048 & 2048-like Games (C++ 11)
+ * trace.h: Lightweight scoped tracing with Chrome trace (Perfetto) export
+ *
+ * Author: Theory of Computer Games (TCG 2021)
+ *         Computer Games and Intelligence (CGI) Lab, NYCU, Taiwan
+ *         https://cgilab.nctu.edu.tw/
+ */
+
+#pragma once
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+/**
+ * spans are recorded only if the program is compiled with -DTRACE (see 'make trace'),
+ * otherwise TRACE_SCOPE expands to nothing and costs nothing
+ *
+ * each thread records into its own ring buffer of TRACE_CAPACITY spans,
+ * so that the oldest spans are overwritten in long runs
+ * timestamps are raw TSC ticks, which are converted to microseconds on export
+ *
+ * recording can be switched per thread by sample(), e.g., to trace one in every N episodes,
+ * which keeps the overhead of fine-grained spans low
+ */
+#ifndef TRACE_CAPACITY
+#define TRACE_CAPACITY (1 << 18)
+#endif
+
+#ifdef TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) trace::span TRACE_CONCAT(trace_span_, __LINE__)(name)
+#else
+#define TRACE_SCOPE(name)
+#endif
+
+class trace {
+public:
+#ifdef TRACE
+	static constexpr bool enabled = true;
+#else
+	static constexpr bool enabled = false;
+#endif
+
+	static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+	}
+
+	/**
+	 * RAII span, the name should be a string literal
+	 */
+	class span {
+	public:
+		span(const char* name) : name(recording() ? name : nullptr), begin(this->name ? now() : 0) {}
+		~span() { if (name) buffer().push(name, begin, now()); }
+	private:
+		const char* name;
+		uint64_t begin;
+	};
+
+	/**
+	 * enable or disable recording of the calling thread
+	 */
+	static void sample(bool on) { recording() = on; }
+
+	/**
+	 * export all recorded spans of all threads as Chrome trace JSON,
+	 * which can be opened by chrome://tracing or https://ui.perfetto.dev
+	 */
+	static bool dump(const std::string& path) {
+		std::ofstream out(path, std::ios::out | std::ios::trunc);
+		if (!out.is_open()) return false;
+		double tick = origin().ticks_per_usec();
+		std::lock_guard<std::mutex> lock(registry().lock);
+		uint64_t base = -1ull;
+		for (ring* buf : registry().rings) {
+			size_t size = std::min<uint64_t>(buf->count, TRACE_CAPACITY);
+			for (size_t i = buf->count - size; i < buf->count; i++)
+				base = std::min(base, buf->data[i % TRACE_CAPACITY].begin);
+		}
+		out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[" << std::endl;
+		bool first = true;
+		for (ring* buf : registry().rings) {
+			size_t size = std::min<uint64_t>(buf->count, TRACE_CAPACITY);
+			for (size_t i = buf->count - size; i < buf->count; i++) {
+				const record& rec = buf->data[i % TRACE_CAPACITY];
+				out << (first ? "" : ",\n") << "{\"name\":\"" << rec.name << "\",\"ph\":\"X\",\"pid\":1";
+				out << ",\"tid\":" << buf->tid;
+				out << ",\"ts\":" << std::fixed << ((rec.begin - base) / tick);
+				out << ",\"dur\":" << std::fixed << ((rec.end - rec.begin) / tick) << "}";
+				first = false;
+			}
+		}
+		out << std::endl << "]}" << std::endl;
+		return true;
+	}
+
+	/**
+	 * export to the given path when the program exits,
+	 * so that spans recorded by destructors of agents are also included
+	 */
+	static void dump_at_exit(const std::string& path) {
+		struct exporter {
+			std::string path;
+			exporter() { origin(); registry(); }
+			~exporter() { if (path.size() && !dump(path)) std::cerr << "cannot write trace to " << path << std::endl; }
+		};
+		static exporter last;
+		last.path = path;
+	}
+
+private:
+	struct record {
+		const char* name;
+		uint64_t begin, end;
+	};
+
+	struct ring {
+		std::vector<record> data;
+		uint64_t count;
+		unsigned tid;
+		ring(unsigned tid) : data(TRACE_CAPACITY), count(0), tid(tid) {}
+		void push(const char* name, uint64_t begin, uint64_t end) {
+			data[count++ % TRACE_CAPACITY] = { name, begin, end };
+		}
+	};
+
+	struct clock {
+		uint64_t tsc;
+		std::chrono::steady_clock::time_point when;
+		clock() : tsc(now()), when(std::chrono::steady_clock::now()) {}
+		double ticks_per_usec() const {
+			auto usec = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - when).count();
+			return usec > 0 ? (now() - tsc) / usec : 1.0;
+		}
+	};
+
+	struct directory {
+		std::mutex lock;
+		std::vector<ring*> rings;
+	};
+
+	static clock& origin() { static clock c; return c; }
+	static bool& recording() { static thread_local bool on = true; return on; }
+	static directory& registry() { static directory r; return r; }
+
+	/**
+	 * the ring buffer of the calling thread, which outlives the thread for exporting
+	 */
+	static ring& buffer() {
+		static thread_local ring* buf = nullptr;
+		if (buf) return *buf;
+		origin();
+		std::lock_guard<std::mutex> lock(registry().lock);
+		buf = new ring(registry().rings.size() + 1);
+		registry().rings.push_back(buf);
+		return *buf;
+	}
+};
@@ -11,39 +11,306 @@
 #include <iostream>
 #include <vector>
 #include <utility>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <algorithm>
 
 class weight {
 public:
 	typedef float type;
 
+	/**
+	 * consistency of concurrent updates, for training a shared table by multiple threads
+	 * plain:   racy read-modify-write, updates to hot entries may be lost
+	 * atomic:  compare-and-swap loop per entry
+	 * striped: spinlocks striped over cache lines
+	 */
+	enum consistency { plain, atomic, striped };
+
 public:
-	weight() {}
-	weight(size_t len) : value(len) {}
-	weight(weight&& f) : value(std::move(f.value)) {}
-	weight(const weight& f) = default;
+	weight() : base(nullptr), length(0), policy(plain), stride(0), reciprocal(0) {}
+	weight(size_t len) : value(len), base(value.data()), length(len), policy(plain), dirty(words()), stride(0), reciprocal(0) {}
+	weight(weight&& f) : value(std::move(f.value)), base(f.base), length(f.length), policy(f.policy), dirty(std::move(f.dirty)),
+		directory(std::move(f.directory)), stride(f.stride), reciprocal(f.reciprocal) { f.base = nullptr; f.length = 0; f.stride = 0; }
+	weight(const weight& f) : base(nullptr), length(0), stride(0) { *this = f; }
+	~weight() { release(); }
+
+	/**
+	 * a view of external storage (e.g., shared memory), which is not owned by the table
+	 */
+	weight(type* view, size_t len) : base(view), length(len), policy(plain), dirty(words()), stride(0), reciprocal(0) {}
+
+	weight& operator =(const weight& f) {
+		if (this == &f) return *this;
+		release();
+		value = f.value;
+		base = f.owned() ? value.data() : f.base;
+		length = f.length;
+		policy = f.policy;
+		dirty = f.dirty;
+		stride = f.stride;
+		reciprocal = f.reciprocal;
+		directory.assign(f.directory.size(), nullptr);
+		for (size_t k = 0; k < directory.size(); k++) {
+			if (!f.directory[k]) continue;
+			directory[k] = new type[stride];
+			std::copy(f.directory[k], f.directory[k] + stride, directory[k]);
+		}
+		return *this;
+	}
+
+	/**
+	 * the compact layout allocates blocks on write, and reads unallocated blocks as zero
+	 * note that reading through a non-const table allocates the block, use a const reference for lookups
+	 */
+	type& operator[] (size_t i) { return stride ? *slot(i) : base[i]; }
+	const type& operator[] (size_t i) const { return stride ? peek(i) : base[i]; }
+	size_t size() const { return length; }
+	bool owned() const { return base == value.data(); }
 
-	weight& operator =(const weight& f) = default;
-	type& operator[] (size_t i) { return value[i]; }
-	const type& operator[] (size_t i) const { return value[i]; }
-	size_t size() const { return value.size(); }
+	/**
+	 * convert the flat table into a two-level layout of blocks of 'block' entries,
+	 * where the directory is indexed by i / block, and blocks of all zeros are not allocated
+	 * e.g., blocks of 25^2 entries make the first level the first two cells of a 4-tuple
+	 */
+	void compact(size_t block) {
+		if (stride || !block || length * block >= (uint64_t(1) << 40)) return;
+		std::vector<type*> dir((length + block - 1) / block, nullptr);
+		for (size_t k = 0; k < dir.size(); k++) {
+			const type* begin = base + k * block;
+			const type* end = base + std::min(length, (k + 1) * block);
+			if (std::all_of(begin, end, [](type v) { return v == 0; })) continue;
+			dir[k] = new type[block]();
+			std::copy(begin, end, dir[k]);
+		}
+		directory.swap(dir);
+		stride = block;
+		reciprocal = ((uint64_t(1) << 40) / block) + 1;
+		std::vector<type>().swap(value);
+		base = nullptr;
+	}
+	bool compact() const { return stride != 0; }
+	size_t block() const { return stride; }
+
+	/**
+	 * the bytes of memory held by the table, excluding views of external storage
+	 */
+	size_t footprint() const {
+		if (!stride) return owned() ? sizeof(type) * length : 0;
+		size_t blocks = std::count_if(directory.begin(), directory.end(), [](type* b) { return b != nullptr; });
+		return sizeof(type*) * directory.size() + sizeof(type) * stride * blocks;
+	}
+
+	consistency mode() const { return policy; }
+	consistency mode(consistency m) { consistency old = policy; policy = m; return old; }
+
+	/**
+	 * add delta to the i-th entry under the consistency mode of the table
+	 * the page of the entry is marked as touched, see touched()
+	 */
+	void update(size_t i, type delta) {
+		touch(i);
+		type* entry = stride ? slot(i) : &base[i];
+		switch (policy) {
+		default:
+		case plain:
+			*entry += delta;
+			break;
+		case atomic: {
+			type old, sum;
+			__atomic_load(entry, &old, __ATOMIC_RELAXED);
+			sum = old + delta;
+			while (!__atomic_compare_exchange(entry, &old, &sum, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				sum = old + delta;
+			break;
+		}
+		case striped: {
+			std::atomic_flag& lock = stripe(entry);
+			while (lock.test_and_set(std::memory_order_acquire));
+			*entry += delta;
+			lock.clear(std::memory_order_release);
+			break;
+		}
+		}
+	}
+
+	static consistency parse(const std::string& name) {
+		if (name == "atomic") return atomic;
+		if (name == "striped") return striped;
+		return plain;
+	}
 
 public:
+	/**
+	 * entries are tracked in pages of 256 bytes (4 cache lines), where a page is touched once any of its entries is updated
+	 * writes through operator[] are not tracked
+	 */
+	static const size_t page = 256 / sizeof(type);
+	size_t pages() const { return (length + page - 1) / page; }
+	bool touched(size_t p) const { return (dirty[p / 64] >> (p % 64)) & 1; }
+	size_t touched() const {
+		size_t n = 0;
+		for (uint64_t word : dirty) n += __builtin_popcountll(word);
+		return n;
+	}
+	void clean() { std::fill(dirty.begin(), dirty.end(), 0); }
+
+	/**
+	 * the number of nonzero entries, i.e., entries ever trained since the table was initialized
+	 */
+	size_t nonzero() const {
+		size_t n = 0;
+		const weight& w = *this;
+		for (size_t i = 0; i < length; i++) n += (w[i] != 0);
+		return n;
+	}
+
+	/**
+	 * write the touched pages only, as
+	 * uint64 length, uint64 count, then 'count' records of (uint64 page, floats of the page)
+	 */
+	void write_delta(std::ostream& out) const {
+		uint64_t size = length, count = touched();
+		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
+		out.write(reinterpret_cast<const char*>(&count), sizeof(uint64_t));
+		for (uint64_t p = 0; p < pages(); p++) {
+			if (!touched(p)) continue;
+			out.write(reinterpret_cast<const char*>(&p), sizeof(uint64_t));
+			write_range(out, p * page, extent(p));
+		}
+	}
+
+	/**
+	 * overwrite the pages of a delta written by write_delta, which is false if the delta does not fit
+	 * the patched pages are not marked as touched
+	 */
+	bool read_delta(std::istream& in) {
+		uint64_t size = 0, count = 0;
+		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
+		in.read(reinterpret_cast<char*>(&count), sizeof(uint64_t));
+		if (size != length) return false;
+		for (uint64_t k = 0, p; k < count && in; k++) {
+			in.read(reinterpret_cast<char*>(&p), sizeof(uint64_t));
+			if (p >= pages()) return false;
+			read_range(in, p * page, extent(p));
+		}
+		return bool(in);
+	}
+
+	/**
+	 * copy the entries [begin, begin + count) to or from a plain array, in either layout,
+	 * where entries of unallocated blocks are copied out as zero, and zeros are not copied into them
+	 */
+	void copy_to(size_t begin, size_t count, type* out) const {
+		if (!stride) std::copy(base + begin, base + begin + count, out);
+		else for (size_t i = 0; i < count; i++) out[i] = peek(begin + i);
+	}
+	void copy_from(size_t begin, size_t count, const type* in) {
+		if (!stride) std::copy(in, in + count, base + begin);
+		else for (size_t i = 0; i < count; i++)
+			if (in[i] != 0 || peek(begin + i) != 0) (*this)[begin + i] = in[i];
+	}
+
 	friend std::ostream& operator <<(std::ostream& out, const weight& w) {
-		auto& value = w.value;
-		uint64_t size = value.size();
+		uint64_t size = w.length;
 		out.write(reinterpret_cast<const char*>(&size), sizeof(uint64_t));
-		out.write(reinterpret_cast<const char*>(value.data()), sizeof(type) * size);
+		w.write_range(out, 0, size);
 		return out;
 	}
 	friend std::istream& operator >>(std::istream& in, weight& w) {
 		auto& value = w.value;
+		w.release();
 		uint64_t size = 0;
 		in.read(reinterpret_cast<char*>(&size), sizeof(uint64_t));
 		value.resize(size);
+		w.base = value.data();
+		w.length = size;
+		w.dirty.assign(w.words(), 0);
 		in.read(reinterpret_cast<char*>(value.data()), sizeof(type) * size);
 		return in;
 	}
 
+protected:
+	/**
+	 * the entry of the compact layout, where i / stride is computed by a multiply with the reciprocal,
+	 * which is exact as long as length * stride < 2^40
+	 */
+	size_t block_of(size_t i) const { return (uint64_t(i) * reciprocal) >> 40; }
+	const type& peek(size_t i) const {
+		static const type zero = 0;
+		size_t k = block_of(i);
+		const type* b = directory[k];
+		return b ? b[i - k * stride] : zero;
+	}
+	type* slot(size_t i) {
+		size_t k = block_of(i);
+		type* b = __atomic_load_n(&directory[k], __ATOMIC_ACQUIRE);
+		if (!b) {
+			type* fresh = new type[stride]();
+			if (__atomic_compare_exchange_n(&directory[k], &b, fresh, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+				b = fresh;
+			else
+				delete[] fresh;
+		}
+		return b + (i - k * stride);
+	}
+	void release() {
+		for (type* b : directory) delete[] b;
+		directory.clear();
+		stride = 0;
+	}
+
+	void write_range(std::ostream& out, size_t begin, size_t count) const {
+		if (!stride) {
+			out.write(reinterpret_cast<const char*>(base + begin), sizeof(type) * count);
+			return;
+		}
+		std::vector<type> buffer(count);
+		copy_to(begin, count, buffer.data());
+		out.write(reinterpret_cast<const char*>(buffer.data()), sizeof(type) * count);
+	}
+	void read_range(std::istream& in, size_t begin, size_t count) {
+		if (!stride) {
+			in.read(reinterpret_cast<char*>(base + begin), sizeof(type) * count);
+			return;
+		}
+		std::vector<type> buffer(count);
+		in.read(reinterpret_cast<char*>(buffer.data()), sizeof(type) * count);
+		copy_from(begin, count, buffer.data());
+	}
+
+	size_t words() const { return (pages() + 63) / 64; }
+	size_t extent(size_t p) const { return std::min(page, length - p * page); }
+
+	/**
+	 * mark the page of the i-th entry, skipping the atomic write once the page is touched
+	 */
+	void touch(size_t i) {
+		uint64_t& word = dirty[i / page / 64];
+		uint64_t bit = uint64_t(1) << (i / page % 64);
+		if (!(__atomic_load_n(&word, __ATOMIC_RELAXED) & bit))
+			__atomic_fetch_or(&word, bit, __ATOMIC_RELAXED);
+	}
+
+	/**
+	 * the spinlock of the cache line of an entry, shared by all tables
+	 */
+	static std::atomic_flag& stripe(const type* entry) {
+		static const size_t stripes = 1 << 12;
+		static std::atomic_flag locks[stripes]; // zero-initialized, i.e., clear
+		return locks[(reinterpret_cast<uintptr_t>(entry) >> 6) & (stripes - 1)];
+	}
+
 protected:
 	std::vector<type> value;
+	type* base;
+	size_t length;
+	consistency policy;
+	std::vector<uint64_t> dirty;
+
+	// compact layout, see compact()
+	std::vector<type*> directory;
+	size_t stride;
+	uint64_t reciprocal;
 };